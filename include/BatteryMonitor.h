@@ -0,0 +1,151 @@
+#pragma once
+
+#include "StageProfiler.h"
+
+// Reads the battery through a voltage divider on an analog pin, filters out
+// the noise the LED load puts on the reading, and decides when the battery is
+// dead (with hysteresis, so the cutoff doesn't flicker) and when the voltage
+// is worth publishing over BLE.
+//
+// Each sample averages OVERSAMPLE reads; the last MEDIAN_WINDOW samples are
+// median-filtered to drop spikes from LED current steps, then smoothed with
+// an EMA. Assumes analogReadResolution(12).
+class BatteryMonitor
+{
+public:
+    static const int OVERSAMPLE = 8;
+    static const int MEDIAN_WINDOW = 3;
+
+    // Time between samples.
+    unsigned long sample_period_ms = 100;
+    // EMA weight of each new (median-filtered) sample.
+    float ema_alpha = 0.1;
+    // Once dead, the battery only counts as recovered above
+    // min_voltage + recovery_margin.
+    float recovery_margin = 0.15;
+    // Publish when the filtered voltage has moved this much since the last
+    // publish, and at least every publish_period_ms regardless.
+    float publish_delta = 0.05;
+    unsigned long publish_period_ms = 10000;
+    // Voltage that counts as full, for charge_level().
+    float full_voltage = 4.2;
+
+    // The battery sits in the middle of a voltage divider, so the read voltage is
+    //   read voltage = bat_voltage * (TO_GND)/(TO_GND + TO_HOT)
+    BatteryMonitor(int pin, float ohms_to_3v3, float ohms_to_gnd, float min_voltage)
+        : m_pin(pin),
+          m_divider_scale((ohms_to_3v3 + ohms_to_gnd) / ohms_to_gnd),
+          m_min_voltage(min_voltage)
+    {
+    }
+
+    // Seeds the filters with a real reading, so they don't start from 0V
+    // (which would read as dead).
+    void setup()
+    {
+        float v = read_voltage();
+        for (int i = 0; i < MEDIAN_WINDOW; i++)
+        {
+            m_samples[i] = v;
+        }
+        m_voltage = v;
+        m_dead = v < m_min_voltage;
+        m_last_sample_ms = millis();
+    }
+
+    void update()
+    {
+        unsigned long t = millis();
+        if (t - m_last_sample_ms < sample_period_ms)
+        {
+            return;
+        }
+        m_last_sample_ms = t;
+
+        m_samples[m_next_sample] = read_voltage();
+        m_next_sample = (m_next_sample + 1) % MEDIAN_WINDOW;
+        m_voltage += ema_alpha * (median() - m_voltage);
+
+        if (m_dead)
+        {
+            m_dead = m_voltage < m_min_voltage + recovery_margin;
+        }
+        else
+        {
+            m_dead = m_voltage < m_min_voltage;
+        }
+    }
+
+    float voltage() const
+    {
+        return m_voltage;
+    }
+
+    bool is_dead() const
+    {
+        return m_dead;
+    }
+
+    // Charge as a level from 1 (at the cutoff) to levels (full), linear in
+    // voltage: a rough guide, as a LiPo's discharge curve isn't.
+    int charge_level(int levels) const
+    {
+        float fraction = (m_voltage - m_min_voltage) / (full_voltage - m_min_voltage);
+        return constrain(1 + (int)(fraction * levels), 1, levels);
+    }
+
+    // True if the voltage has changed meaningfully, the dead state has
+    // flipped, or the publish period has elapsed. Counts as published, so
+    // callers should publish whenever this returns true.
+    bool should_publish()
+    {
+        unsigned long t = millis();
+        if (m_has_published &&
+            m_dead == m_last_published_dead &&
+            fabs(m_voltage - m_last_published_voltage) < publish_delta &&
+            t - m_last_publish_ms < publish_period_ms)
+        {
+            return false;
+        }
+        m_has_published = true;
+        m_last_published_voltage = m_voltage;
+        m_last_published_dead = m_dead;
+        m_last_publish_ms = t;
+        return true;
+    }
+
+private:
+    float read_voltage()
+    {
+        StageTimer timer(STAGE_BATTERY_READ);
+        long sum = 0;
+        for (int i = 0; i < OVERSAMPLE; i++)
+        {
+            sum += analogRead(m_pin);
+        }
+        float read_voltage = 3.3 * ((float)sum / OVERSAMPLE) / 4096.;
+        return read_voltage * m_divider_scale;
+    }
+
+    // Median of three; MEDIAN_WINDOW is fixed at 3.
+    float median() const
+    {
+        float a = m_samples[0], b = m_samples[1], c = m_samples[2];
+        return max(min(a, b), min(max(a, b), c));
+    }
+
+    int m_pin;
+    float m_divider_scale;
+    float m_min_voltage;
+
+    float m_samples[MEDIAN_WINDOW] = {0};
+    int m_next_sample = 0;
+    unsigned long m_last_sample_ms = 0;
+    float m_voltage = 0;
+    bool m_dead = false;
+
+    bool m_has_published = false;
+    float m_last_published_voltage = 0;
+    bool m_last_published_dead = false;
+    unsigned long m_last_publish_ms = 0;
+};
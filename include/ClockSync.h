@@ -0,0 +1,133 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Locks a prop's effect clock to a reference clock (the phone's), so props
+// running the same time-based effect stay in phase instead of drifting
+// apart with their crystals.
+//
+// The central periodically writes its current time; each write is a
+// sample of (reference time, local time). The estimate is a second order
+// loop: every sample's error against the prediction nudges both the offset
+// and the rate, so the crystal's drift (tens of ppm) is tracked as well as
+// the offset. The central should dither its write period by at least a
+// BLE poll period, so the poll's timestamping delay averages out. Radio
+// latency shifts every prop about equally, so props stay in phase with each
+// other even though they all run slightly behind the phone.
+//
+// Core estimation takes local time explicitly so it can be simulated; the
+// micros()-based wrappers are what the firmware uses.
+class ClockSync
+{
+public:
+    // Fraction of each sample's error applied to the offset. Latency only
+    // ever makes a sample look late, so samples earlier than predicted
+    // (the least delayed ones) are trusted much more than late ones, and
+    // the estimate settles below the mean latency, where there's less
+    // jitter.
+    double early_gain = 0.2;
+    double late_gain = 0.005;
+    // Fraction of each offset correction, spread over the time since the
+    // last sample, also applied to the rate.
+    double rate_gain = 0.002;
+    // Errors bigger than this re-anchor instead of slewing, e.g. when a
+    // different phone takes over.
+    double step_threshold_us = 500000;
+    // Largest rate correction believed, in ppm.
+    double max_rate_ppm = 500;
+
+    unsigned long samples = 0;
+    unsigned long steps = 0;
+    // Error of the last sample against the prediction.
+    double last_error_us = 0;
+
+    bool synced() const
+    {
+        return m_synced;
+    }
+
+    // Estimated rate of the reference clock relative to ours, minus 1, in ppm.
+    double rate_ppm() const
+    {
+        return (m_rate - 1.) * 1e6;
+    }
+
+    void add_sample(uint64_t reference_us, uint64_t local_us)
+    {
+        samples++;
+        if (!m_synced)
+        {
+            anchor(reference_us, local_us);
+            m_rate = 1.;
+            m_synced = true;
+            return;
+        }
+        double dt_local = (double)(local_us - m_anchor_local_us);
+        double predicted = m_anchor_reference_us + dt_local * m_rate;
+        double error = (double)reference_us - predicted;
+        last_error_us = error;
+        if (error > step_threshold_us || error < -step_threshold_us)
+        {
+            steps++;
+            anchor(reference_us, local_us);
+            return;
+        }
+        double correction = (error > 0 ? early_gain : late_gain) * error;
+        if (dt_local > 0)
+        {
+            m_rate += rate_gain * correction / dt_local;
+            m_rate = constrain(m_rate, 1. - max_rate_ppm * 1e-6, 1. + max_rate_ppm * 1e-6);
+        }
+        m_anchor_reference_us = predicted + correction;
+        m_anchor_local_us = local_us;
+    }
+
+    // Reference time at the given local time; local time itself until the
+    // first sample.
+    double reference_us(uint64_t local_us) const
+    {
+        if (!m_synced)
+        {
+            return (double)local_us;
+        }
+        return m_anchor_reference_us + (double)(int64_t)(local_us - m_anchor_local_us) * m_rate;
+    }
+
+    // micros(), extended to 64 bits. Must be called at least every ~71
+    // minutes (the effect clock is read every frame).
+    uint64_t local_us()
+    {
+        uint32_t now = micros();
+        if (now < m_last_micros)
+        {
+            m_micros_high++;
+        }
+        m_last_micros = now;
+        return ((uint64_t)m_micros_high << 32) | now;
+    }
+
+    void add_sample(uint64_t reference_us)
+    {
+        add_sample(reference_us, local_us());
+    }
+
+    // The t to feed effects.
+    double now_seconds()
+    {
+        return reference_us(local_us()) / 1e6;
+    }
+
+private:
+    void anchor(uint64_t reference_us, uint64_t local_us)
+    {
+        m_anchor_reference_us = (double)reference_us;
+        m_anchor_local_us = local_us;
+    }
+
+    bool m_synced = false;
+    double m_anchor_reference_us = 0;
+    uint64_t m_anchor_local_us = 0;
+    double m_rate = 1.;
+    uint32_t m_last_micros = 0;
+    uint32_t m_micros_high = 0;
+};
@@ -0,0 +1,79 @@
+#pragma once
+
+// Keeps the strips' current draw under what the prop's pack and regulator
+// can supply. PropLEDDriver sums each frame's channel levels after color
+// correction and before quantizing; fit_frame() turns that into an
+// estimated draw and returns the brightness scale that holds it under the
+// budget, which the frame is then quantized at. So no frame goes out over
+// budget, a jump from dark to full white included, and each frame is only
+// quantized once.
+//
+// The estimate is the usual WS2812 rule of thumb: each channel draws
+// ma_per_channel at full and proportionally less when dimmer, plus a
+// quiescent idle_ma_per_pixel whatever it shows.
+class CurrentLimiter
+{
+public:
+  // For all of the prop's strips together; 0 only estimates.
+  unsigned long budget_ma = 0;
+  float ma_per_channel = 20;
+  float idle_ma_per_pixel = 1;
+
+  // The last frame's scale, Q16 (65536 == unscaled).
+  uint32_t scale_q16() const
+  {
+    return m_scale_q16;
+  }
+
+  // level_sum: the frame's channel levels summed before scaling, where a
+  // channel at full is full_level. Records the frame's draw and returns
+  // the scale (Q16) to write it at: unscaled if it fits the budget, else
+  // just enough below to fit.
+  uint32_t fit_frame(uint32_t level_sum, uint32_t full_level, int num_pixels)
+  {
+    float idle_ma = idle_ma_per_pixel * num_pixels;
+    float channels_ma = ma_per_channel * level_sum / full_level;
+    m_unlimited_ma = idle_ma + channels_ma;
+    if (budget_ma == 0 || m_unlimited_ma <= budget_ma)
+    {
+      m_scale_q16 = 65536;
+    }
+    else
+    {
+      m_scale_q16 = fitting_scale_q16(idle_ma, channels_ma);
+      m_limited_frames++;
+    }
+    m_estimated_ma = idle_ma + channels_ma * m_scale_q16 / 65536.f;
+    return m_scale_q16;
+  }
+
+  // Draw of the last frame as shown, i.e. after limiting.
+  float estimated_ma() const
+  {
+    return m_estimated_ma;
+  }
+
+  // What the last frame would have drawn unlimited.
+  float unlimited_ma() const
+  {
+    return m_unlimited_ma;
+  }
+
+  unsigned long limited_frames() const
+  {
+    return m_limited_frames;
+  }
+
+private:
+  // Only called over budget, so channels_ma > 0.
+  uint32_t fitting_scale_q16(float idle_ma, float channels_ma) const
+  {
+    float headroom_ma = max(budget_ma - idle_ma, 0.f);
+    return (uint32_t)(65536.f * headroom_ma / channels_ma);
+  }
+
+  uint32_t m_scale_q16 = 65536;
+  float m_estimated_ma = 0;
+  float m_unlimited_ma = 0;
+  unsigned long m_limited_frames = 0;
+};
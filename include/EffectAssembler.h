@@ -0,0 +1,193 @@
+#pragma once
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "EffectProgram.h"
+
+// Builds EffectProgram bytecode from text, for the host tools. Source is
+// whitespace-separated tokens in reverse Polish order; ';' starts a comment
+// that runs to the end of the line.
+//   1.5, -0.25    Push a number (pixel indices, seconds and colors are all
+//                 just numbers; colors and outputs are 0..1).
+//   t, i          Push seconds / the logical pixel index.
+//   in_r ...      Push the input color's channels.
+//   load0..3      Push a register; store0..3 pops into one.
+//   #rrggbb       Append a palette entry (may appear anywhere).
+//   dup swap drop add sub mul min max abs frac sin cos palette
+// e.g. a red-to-blue gradient scrolling at 1 turn per 10 s:
+//   #ff0000 #0000ff   i 0.01 mul t 0.1 mul add palette
+namespace EffectAssembler
+{
+  typedef struct Mnemonic
+  {
+    const char *name;
+    uint8_t op;
+  } Mnemonic;
+
+  static const Mnemonic MNEMONICS[] = {
+      {"t", EffectProgram::OP_T},
+      {"i", EffectProgram::OP_I},
+      {"in_r", EffectProgram::OP_IN_R},
+      {"in_g", EffectProgram::OP_IN_G},
+      {"in_b", EffectProgram::OP_IN_B},
+      {"dup", EffectProgram::OP_DUP},
+      {"swap", EffectProgram::OP_SWAP},
+      {"drop", EffectProgram::OP_DROP},
+      {"add", EffectProgram::OP_ADD},
+      {"sub", EffectProgram::OP_SUB},
+      {"mul", EffectProgram::OP_MUL},
+      {"min", EffectProgram::OP_MIN},
+      {"max", EffectProgram::OP_MAX},
+      {"abs", EffectProgram::OP_ABS},
+      {"frac", EffectProgram::OP_FRAC},
+      {"sin", EffectProgram::OP_SIN},
+      {"cos", EffectProgram::OP_COS},
+      {"palette", EffectProgram::OP_PALETTE},
+  };
+
+  // Assembles source into out (at least EffectProgram::MAX_SIZE bytes).
+  // Returns the program length, or -1 with a message in error.
+  inline int assemble(const char *source, uint8_t *out, char *error, int error_size)
+  {
+    uint8_t code[EffectProgram::MAX_SIZE];
+    uint8_t palette[3 * EffectProgram::MAX_PALETTE];
+    int code_length = 0;
+    int palette_size = 0;
+
+    const char *p = source;
+    char token[32];
+    while (true)
+    {
+      // Skip whitespace and comments.
+      while (*p && (isspace((unsigned char)*p) || *p == ';'))
+      {
+        if (*p == ';')
+        {
+          while (*p && *p != '\n')
+          {
+            p++;
+          }
+        }
+        else
+        {
+          p++;
+        }
+      }
+      if (!*p)
+      {
+        break;
+      }
+      int n = 0;
+      while (*p && !isspace((unsigned char)*p) && *p != ';')
+      {
+        if (n < (int)sizeof(token) - 1)
+        {
+          token[n++] = *p;
+        }
+        p++;
+      }
+      token[n] = 0;
+
+      // Leave room for the longest instruction.
+      if (code_length + 5 > (int)sizeof(code))
+      {
+        snprintf(error, error_size, "program too long");
+        return -1;
+      }
+
+      char *end;
+      if (token[0] == '#')
+      {
+        unsigned long rgb = strtoul(token + 1, &end, 16);
+        if (*end || end - token != 7)
+        {
+          snprintf(error, error_size, "bad color '%s'", token);
+          return -1;
+        }
+        if (palette_size == EffectProgram::MAX_PALETTE)
+        {
+          snprintf(error, error_size, "more than %d palette entries", (int)EffectProgram::MAX_PALETTE);
+          return -1;
+        }
+        palette[3 * palette_size] = rgb >> 16;
+        palette[3 * palette_size + 1] = rgb >> 8;
+        palette[3 * palette_size + 2] = rgb;
+        palette_size++;
+        continue;
+      }
+
+      double value = strtod(token, &end);
+      if (end != token && !*end)
+      {
+        int32_t q15 = (int32_t)(value * 32768. + (value < 0 ? -0.5 : 0.5));
+        if (q15 >= -32768 && q15 <= 32767)
+        {
+          code[code_length++] = EffectProgram::OP_PUSH16;
+          code[code_length++] = q15 & 0xFF;
+          code[code_length++] = (q15 >> 8) & 0xFF;
+        }
+        else
+        {
+          code[code_length++] = EffectProgram::OP_PUSH32;
+          for (int k = 0; k < 4; k++)
+          {
+            code[code_length++] = ((uint32_t)q15 >> (8 * k)) & 0xFF;
+          }
+        }
+        continue;
+      }
+
+      if ((!strncmp(token, "load", 4) || !strncmp(token, "store", 5)) && n > 0 && isdigit((unsigned char)token[n - 1]))
+      {
+        bool load = token[0] == 'l';
+        int reg = atoi(token + (load ? 4 : 5));
+        if (reg < 0 || reg >= EffectProgram::NUM_REGISTERS)
+        {
+          snprintf(error, error_size, "no register in '%s'", token);
+          return -1;
+        }
+        code[code_length++] = load ? EffectProgram::OP_LOAD : EffectProgram::OP_STORE;
+        code[code_length++] = reg;
+        continue;
+      }
+
+      bool found = false;
+      for (unsigned int k = 0; k < sizeof(MNEMONICS) / sizeof(MNEMONICS[0]); k++)
+      {
+        if (!strcmp(token, MNEMONICS[k].name))
+        {
+          code[code_length++] = MNEMONICS[k].op;
+          found = true;
+          break;
+        }
+      }
+      if (!found)
+      {
+        snprintf(error, error_size, "unknown token '%s'", token);
+        return -1;
+      }
+    }
+
+    int length = 2 + 3 * palette_size + code_length;
+    if (length > EffectProgram::MAX_SIZE)
+    {
+      snprintf(error, error_size, "program is %d bytes, limit is %d", length, (int)EffectProgram::MAX_SIZE);
+      return -1;
+    }
+    out[0] = EffectProgram::FORMAT_VERSION;
+    out[1] = palette_size;
+    memcpy(out + 2, palette, 3 * palette_size);
+    memcpy(out + 2 + 3 * palette_size, code, code_length);
+
+    int code_start;
+    if (!EffectProgram::validate(out, length, &code_start))
+    {
+      snprintf(error, error_size, "stack must end with exactly r g b, never going below empty or above %d deep "
+                                  "(and palette needs #rrggbb entries)",
+               (int)EffectProgram::MAX_STACK);
+      return -1;
+    }
+    return length;
+  }
+}
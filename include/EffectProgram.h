@@ -0,0 +1,366 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include "FixedTrig.h"
+
+// A small stack machine for describing LED effects as data, so new looks
+// can be uploaded over BLE instead of needing a new ControlMode and a
+// reflash. EffectAssembler.h builds programs from text.
+//
+// A program is evaluated once per logical pixel. Values are Q15 in an
+// int32_t (32768 == 1.0), so they can exceed +-1 (e.g. pixel indices and
+// time). Arithmetic wraps at 32 bits, so whatever a program uploaded over
+// BLE does, it's defined. Angles are in turns (1.0 == one full turn). There are no branches,
+// so the cost per pixel is fixed, and the stack depth is checked once at
+// load time so the interpreter loop doesn't have to.
+//
+// Binary format, at most MAX_SIZE bytes:
+//   [0]      FORMAT_VERSION.
+//   [1]      Palette size P (up to MAX_PALETTE).
+//   [2..]    P palette entries, 3 bytes each (RGB).
+//   [...]    Code: one opcode byte each, some followed by an immediate.
+// The program must leave exactly three values on the stack: R, G and B,
+// each clamped to [0, 1].
+class EffectProgram
+{
+public:
+  enum
+  {
+    FORMAT_VERSION = 1,
+    MAX_SIZE = 240, // Fits a single write at the usual 247 byte MTU.
+    MAX_PALETTE = 16,
+    MAX_STACK = 16,
+    NUM_REGISTERS = 4
+  };
+
+  enum Opcode
+  {
+    OP_PUSH16 = 0x01, // imm: int16 LE.
+    OP_PUSH32 = 0x02, // imm: int32 LE.
+    OP_T = 0x03,      // Seconds.
+    OP_I = 0x04,      // Logical pixel index.
+    OP_IN_R = 0x05,   // Input color channels, 0..1.
+    OP_IN_G = 0x06,
+    OP_IN_B = 0x07,
+    OP_LOAD = 0x08,  // imm: register. Registers start each pixel at 0.
+    OP_STORE = 0x09, // imm: register. Pops.
+    OP_DUP = 0x10,
+    OP_SWAP = 0x11,
+    OP_DROP = 0x12,
+    OP_ADD = 0x20,
+    OP_SUB = 0x21,
+    OP_MUL = 0x22,
+    OP_MIN = 0x23,
+    OP_MAX = 0x24,
+    OP_ABS = 0x25,
+    OP_FRAC = 0x26, // Fractional part, in [0, 1).
+    OP_SIN = 0x30,  // Of turns.
+    OP_COS = 0x31,
+    OP_PALETTE = 0x40 // Pops a position in turns; pushes R, G, B, blended between palette entries.
+  };
+
+  // Per-frame inputs, shared by every pixel.
+  typedef struct Frame
+  {
+    int32_t t;
+    int32_t in_r;
+    int32_t in_g;
+    int32_t in_b;
+  } Frame;
+
+  static Frame make_frame(double t, uint8_t r, uint8_t g, uint8_t b)
+  {
+    // Wraps every 65536 s, which is a whole number of turns.
+    return {(int32_t)(int64_t)(t * 32768.), channel_to_q15(r), channel_to_q15(g), channel_to_q15(b)};
+  }
+
+  // Validates and copies in a program. On failure the previous program is
+  // kept.
+  bool load(const uint8_t *bytes, int length)
+  {
+    int code_start;
+    if (!validate(bytes, length, &code_start))
+    {
+      return false;
+    }
+    memcpy(m_bytes, bytes, length);
+    m_palette_size = bytes[1];
+    m_code = m_bytes + code_start;
+    m_code_end = m_bytes + length;
+    m_num_ops = count_ops(m_code, m_code_end);
+    return true;
+  }
+
+  bool loaded() const
+  {
+    return m_code != nullptr;
+  }
+
+  // Instructions run per pixel.
+  int num_ops() const
+  {
+    return m_num_ops;
+  }
+
+  // Checks that every opcode and immediate is well formed, that the stack
+  // stays within [0, MAX_STACK], and that exactly R, G, B are left.
+  static bool validate(const uint8_t *bytes, int length, int *code_start)
+  {
+    if (length < 2 || length > MAX_SIZE || bytes[0] != FORMAT_VERSION || bytes[1] > MAX_PALETTE)
+    {
+      return false;
+    }
+    int palette_size = bytes[1];
+    int pc = 2 + 3 * palette_size;
+    if (pc > length)
+    {
+      return false;
+    }
+    *code_start = pc;
+    int depth = 0;
+    while (pc < length)
+    {
+      uint8_t op = bytes[pc++];
+      int pops, pushes, imm_size;
+      if (!describe(op, &pops, &pushes, &imm_size) || pc + imm_size > length)
+      {
+        return false;
+      }
+      if ((op == OP_LOAD || op == OP_STORE) && bytes[pc] >= NUM_REGISTERS)
+      {
+        return false;
+      }
+      if (op == OP_PALETTE && palette_size == 0)
+      {
+        return false;
+      }
+      pc += imm_size;
+      depth -= pops;
+      if (depth < 0)
+      {
+        return false;
+      }
+      depth += pushes;
+      if (depth > MAX_STACK)
+      {
+        return false;
+      }
+    }
+    return depth == 3;
+  }
+
+  // Stack effect and immediate size of an opcode; false if unknown.
+  static bool describe(uint8_t op, int *pops, int *pushes, int *imm_size)
+  {
+    *imm_size = 0;
+    switch (op)
+    {
+    case OP_PUSH16:
+      *imm_size = 2;
+      *pops = 0, *pushes = 1;
+      return true;
+    case OP_PUSH32:
+      *imm_size = 4;
+      *pops = 0, *pushes = 1;
+      return true;
+    case OP_T:
+    case OP_I:
+    case OP_IN_R:
+    case OP_IN_G:
+    case OP_IN_B:
+      *pops = 0, *pushes = 1;
+      return true;
+    case OP_LOAD:
+      *imm_size = 1;
+      *pops = 0, *pushes = 1;
+      return true;
+    case OP_STORE:
+      *imm_size = 1;
+      *pops = 1, *pushes = 0;
+      return true;
+    case OP_DUP:
+      *pops = 1, *pushes = 2;
+      return true;
+    case OP_SWAP:
+      *pops = 2, *pushes = 2;
+      return true;
+    case OP_DROP:
+      *pops = 1, *pushes = 0;
+      return true;
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_MIN:
+    case OP_MAX:
+      *pops = 2, *pushes = 1;
+      return true;
+    case OP_ABS:
+    case OP_FRAC:
+    case OP_SIN:
+    case OP_COS:
+      *pops = 1, *pushes = 1;
+      return true;
+    case OP_PALETTE:
+      *pops = 1, *pushes = 3;
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  // Runs the loaded program for pixel i. Must only be called once loaded().
+  inline void eval(const Frame &frame, int i, uint8_t *r, uint8_t *g, uint8_t *b) const
+  {
+    int32_t stack[MAX_STACK];
+    int32_t registers[NUM_REGISTERS] = {0, 0, 0, 0};
+    int32_t *sp = stack; // One past the top.
+    const uint8_t *pc = m_code;
+    while (pc < m_code_end)
+    {
+      switch (*pc++)
+      {
+      case OP_PUSH16:
+        *sp++ = (int16_t)(pc[0] | (pc[1] << 8));
+        pc += 2;
+        break;
+      case OP_PUSH32:
+        *sp++ = (int32_t)((uint32_t)pc[0] | ((uint32_t)pc[1] << 8) | ((uint32_t)pc[2] << 16) | ((uint32_t)pc[3] << 24));
+        pc += 4;
+        break;
+      case OP_T:
+        *sp++ = frame.t;
+        break;
+      case OP_I:
+        *sp++ = i << 15;
+        break;
+      case OP_IN_R:
+        *sp++ = frame.in_r;
+        break;
+      case OP_IN_G:
+        *sp++ = frame.in_g;
+        break;
+      case OP_IN_B:
+        *sp++ = frame.in_b;
+        break;
+      case OP_LOAD:
+        *sp++ = registers[*pc++];
+        break;
+      case OP_STORE:
+        registers[*pc++] = *--sp;
+        break;
+      case OP_DUP:
+        sp[0] = sp[-1];
+        sp++;
+        break;
+      case OP_SWAP:
+      {
+        int32_t top = sp[-1];
+        sp[-1] = sp[-2];
+        sp[-2] = top;
+        break;
+      }
+      case OP_DROP:
+        sp--;
+        break;
+      case OP_ADD:
+        sp[-2] = (int32_t)((uint32_t)sp[-2] + (uint32_t)sp[-1]);
+        sp--;
+        break;
+      case OP_SUB:
+        sp[-2] = (int32_t)((uint32_t)sp[-2] - (uint32_t)sp[-1]);
+        sp--;
+        break;
+      case OP_MUL:
+        // The 64-bit product can't overflow; keep bits 15..46 of it.
+        sp[-2] = (int32_t)(uint32_t)((uint64_t)((int64_t)sp[-2] * sp[-1]) >> 15);
+        sp--;
+        break;
+      case OP_MIN:
+        sp[-2] = sp[-1] < sp[-2] ? sp[-1] : sp[-2];
+        sp--;
+        break;
+      case OP_MAX:
+        sp[-2] = sp[-1] > sp[-2] ? sp[-1] : sp[-2];
+        sp--;
+        break;
+      case OP_ABS:
+        // abs(INT32_MIN) wraps back to INT32_MIN.
+        sp[-1] = sp[-1] < 0 ? (int32_t)(0u - (uint32_t)sp[-1]) : sp[-1];
+        break;
+      case OP_FRAC:
+        sp[-1] &= 0x7FFF;
+        break;
+      case OP_SIN:
+        sp[-1] = FixedTrig::sin_q15((FixedTrig::Phase)sp[-1] << 17);
+        break;
+      case OP_COS:
+        sp[-1] = FixedTrig::cos_q15((FixedTrig::Phase)sp[-1] << 17);
+        break;
+      case OP_PALETTE:
+        push_palette(sp[-1], sp - 1);
+        sp += 2;
+        break;
+      }
+    }
+    *r = q15_to_channel(sp[-3]);
+    *g = q15_to_channel(sp[-2]);
+    *b = q15_to_channel(sp[-1]);
+  }
+
+private:
+  // 0..255 -> Q15 0..1 (255 -> 32767).
+  static inline int32_t channel_to_q15(uint8_t c)
+  {
+    return (c * 257) >> 1;
+  }
+
+  static inline uint8_t q15_to_channel(int32_t v)
+  {
+    if (v <= 0)
+    {
+      return 0;
+    }
+    if (v >= 32767)
+    {
+      return 255;
+    }
+    return (v * 255 + 16384) >> 15;
+  }
+
+  // Blends between consecutive palette entries (wrapping from the last back
+  // to the first) and writes R, G, B as Q15 to out.
+  inline void push_palette(int32_t position, int32_t *out) const
+  {
+    uint32_t scaled = (uint32_t)(position & 0x7FFF) * m_palette_size;
+    int index = scaled >> 15;
+    uint32_t f = scaled & 0x7FFF;
+    const uint8_t *c0 = m_bytes + 2 + 3 * index;
+    const uint8_t *c1 = m_bytes + 2 + 3 * (index + 1 < m_palette_size ? index + 1 : 0);
+    for (int k = 0; k < 3; k++)
+    {
+      // Blend in units of 1/32768 of a channel step, then rescale 255 -> 1.0.
+      uint32_t v = c0[k] * (32768 - f) + c1[k] * f;
+      out[k] = (v * 257) >> 16;
+    }
+  }
+
+  static int count_ops(const uint8_t *pc, const uint8_t *end)
+  {
+    int n = 0;
+    while (pc < end)
+    {
+      int pops, pushes, imm_size;
+      describe(*pc, &pops, &pushes, &imm_size);
+      pc += 1 + imm_size;
+      n++;
+    }
+    return n;
+  }
+
+  uint8_t m_bytes[MAX_SIZE];
+  int m_palette_size = 0;
+  const uint8_t *m_code = nullptr;
+  const uint8_t *m_code_end = nullptr;
+  int m_num_ops = 0;
+};
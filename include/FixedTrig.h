@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stdint.h>
+
+// Fixed-point sine / cosine shared by the LED effects, so the per-pixel
+// math doesn't have to go through soft-float sin/cos every frame.
+//
+// Angles are phase accumulators: a uint32_t where 2^32 is one full turn.
+// Adding to / multiplying a phase wraps around for free, so effects can
+// convert their time-dependent offsets once per frame and then step along
+// the strip with plain integer adds. Results are Q15 (32767 == 1.0).
+namespace FixedTrig
+{
+  typedef uint32_t Phase;
+
+  const int32_t Q15_ONE = 32767;
+
+  // 2^32 / (2 * pi)
+  const double PHASE_PER_RADIAN = 683565275.57643158;
+
+  // round(32767 * sin(2 * pi * k / 256)); the extra final entry lets
+  // sin_q15 interpolate past the last bucket without wrapping the index.
+  static const int16_t SIN_TABLE[257] = {
+    0, 804, 1608, 2410, 3212, 4011, 4808, 5602,
+    6393, 7179, 7962, 8739, 9512, 10278, 11039, 11793,
+    12539, 13279, 14010, 14732, 15446, 16151, 16846, 17530,
+    18204, 18868, 19519, 20159, 20787, 21403, 22005, 22594,
+    23170, 23731, 24279, 24811, 25329, 25832, 26319, 26790,
+    27245, 27683, 28105, 28510, 28898, 29268, 29621, 29956,
+    30273, 30571, 30852, 31113, 31356, 31580, 31785, 31971,
+    32137, 32285, 32412, 32521, 32609, 32678, 32728, 32757,
+    32767, 32757, 32728, 32678, 32609, 32521, 32412, 32285,
+    32137, 31971, 31785, 31580, 31356, 31113, 30852, 30571,
+    30273, 29956, 29621, 29268, 28898, 28510, 28105, 27683,
+    27245, 26790, 26319, 25832, 25329, 24811, 24279, 23731,
+    23170, 22594, 22005, 21403, 20787, 20159, 19519, 18868,
+    18204, 17530, 16846, 16151, 15446, 14732, 14010, 13279,
+    12539, 11793, 11039, 10278, 9512, 8739, 7962, 7179,
+    6393, 5602, 4808, 4011, 3212, 2410, 1608, 804,
+    0, -804, -1608, -2410, -3212, -4011, -4808, -5602,
+    -6393, -7179, -7962, -8739, -9512, -10278, -11039, -11793,
+    -12539, -13279, -14010, -14732, -15446, -16151, -16846, -17530,
+    -18204, -18868, -19519, -20159, -20787, -21403, -22005, -22594,
+    -23170, -23731, -24279, -24811, -25329, -25832, -26319, -26790,
+    -27245, -27683, -28105, -28510, -28898, -29268, -29621, -29956,
+    -30273, -30571, -30852, -31113, -31356, -31580, -31785, -31971,
+    -32137, -32285, -32412, -32521, -32609, -32678, -32728, -32757,
+    -32767, -32757, -32728, -32678, -32609, -32521, -32412, -32285,
+    -32137, -31971, -31785, -31580, -31356, -31113, -30852, -30571,
+    -30273, -29956, -29621, -29268, -28898, -28510, -28105, -27683,
+    -27245, -26790, -26319, -25832, -25329, -24811, -24279, -23731,
+    -23170, -22594, -22005, -21403, -20787, -20159, -19519, -18868,
+    -18204, -17530, -16846, -16151, -15446, -14732, -14010, -13279,
+    -12539, -11793, -11039, -10278, -9512, -8739, -7962, -7179,
+    -6393, -5602, -4808, -4011, -3212, -2410, -1608, -804,
+    0,
+  };
+
+  // Converts an angle in radians to a phase. Only meant to be called a few
+  // times per frame (e.g. for the time offset), not per pixel.
+  inline Phase phase_from_radians(double radians)
+  {
+    // Conversion to unsigned is modular, which is exactly the wrap we want.
+    return (Phase)(int64_t)(radians * PHASE_PER_RADIAN);
+  }
+
+  // sin of a phase, Q15. Uses the top 8 bits to index the table and the next
+  // 8 bits to linearly interpolate; max error is ~1e-4.
+  inline int16_t sin_q15(Phase phase)
+  {
+    uint8_t index = phase >> 24;
+    int32_t frac = (phase >> 16) & 0xFF;
+    int32_t a = SIN_TABLE[index];
+    int32_t b = SIN_TABLE[index + 1];
+    return (int16_t)(a + (((b - a) * frac) >> 8));
+  }
+
+  inline int16_t cos_q15(Phase phase)
+  {
+    return sin_q15(phase + 0x40000000u);
+  }
+
+  // Product of two Q15 values, Q15.
+  inline int16_t mul_q15(int16_t a, int16_t b)
+  {
+    return (int16_t)(((int32_t)a * b) >> 15);
+  }
+}
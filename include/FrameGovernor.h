@@ -0,0 +1,125 @@
+#pragma once
+
+// Keeps rendering inside a frame budget. PropLEDDriver reports when each
+// frame starts and finishes; the governor tracks how long render + show()
+// takes and how often frames actually happen, and drops effects to half
+// spatial resolution while the work doesn't fit the budget.
+class FrameGovernor
+{
+public:
+  enum Quality
+  {
+    FullResolution = 0,
+    // Effects are evaluated on even logical pixels only; odd pixels are
+    // interpolated from their neighbours.
+    HalfResolution = 1
+  };
+
+  // Frame rate the prop is driven at (e.g. its render task's rate).
+  float target_fps = 60;
+  // Fraction of the frame period render + show() may take before quality
+  // drops; the rest is left for BLE and the other tasks.
+  float budget_fraction = 0.5;
+  // Once degraded, full quality comes back when the work takes less than
+  // this fraction of the budget.
+  float recover_fraction = 0.5;
+  // Minimum number of frames between quality changes.
+  unsigned long min_frames_per_quality = 60;
+
+  unsigned long budget_us() const
+  {
+    return (unsigned long)(1e6 * budget_fraction / target_fps);
+  }
+
+  void frame_started()
+  {
+    unsigned long t = micros();
+    if (m_frames > 0)
+    {
+      update_ema(m_interval_ema_us, t - m_frame_start_us);
+    }
+    m_frame_start_us = t;
+  }
+
+  void frame_finished()
+  {
+    update_ema(m_work_ema_us, micros() - m_frame_start_us);
+    m_frames++;
+    m_frames_at_quality++;
+    if (m_quality == HalfResolution)
+    {
+      m_degraded_frames++;
+    }
+
+    if (m_frames_at_quality < min_frames_per_quality)
+    {
+      return;
+    }
+    unsigned long budget = budget_us();
+    if (m_quality == FullResolution && m_work_ema_us > budget)
+    {
+      set_quality(HalfResolution);
+    }
+    else if (m_quality == HalfResolution && m_work_ema_us < budget * recover_fraction)
+    {
+      set_quality(FullResolution);
+    }
+  }
+
+  Quality quality() const
+  {
+    return m_quality;
+  }
+
+  // Frames per second actually achieved, averaged over the last ~16 frames.
+  float achieved_fps() const
+  {
+    return m_interval_ema_us > 0 ? 1e6 / m_interval_ema_us : 0.;
+  }
+
+  // Time spent in render + show(), averaged over the last ~16 frames.
+  unsigned long work_us() const
+  {
+    return m_work_ema_us;
+  }
+
+  unsigned long degraded_frames() const
+  {
+    return m_degraded_frames;
+  }
+
+  unsigned long quality_changes() const
+  {
+    return m_quality_changes;
+  }
+
+private:
+  // EMA with weight 1/16; the first sample seeds it.
+  static void update_ema(unsigned long &ema, unsigned long sample)
+  {
+    if (ema == 0)
+    {
+      ema = sample;
+    }
+    else
+    {
+      ema = ema - (ema >> 4) + (sample >> 4);
+    }
+  }
+
+  void set_quality(Quality quality)
+  {
+    m_quality = quality;
+    m_frames_at_quality = 0;
+    m_quality_changes++;
+  }
+
+  Quality m_quality = FullResolution;
+  unsigned long m_frame_start_us = 0;
+  unsigned long m_interval_ema_us = 0;
+  unsigned long m_work_ema_us = 0;
+  unsigned long m_frames = 0;
+  unsigned long m_frames_at_quality = 0;
+  unsigned long m_degraded_frames = 0;
+  unsigned long m_quality_changes = 0;
+};
@@ -0,0 +1,319 @@
+#pragma once
+
+#include <chrono>
+#include <ctype.h>
+#include <vector>
+#include <Adafruit_NeoPixel.h>
+#include "PropLEDDriver.h"
+
+// Renders a prop's frames on the simulated clock and checks them against
+// frames rendered earlier, so a change to the effect math shows up as a
+// diff. Host only: it drives NativeSim's clock. render-frames writes and
+// compares frame files from the command line; test_golden_frames checks
+// every prop and mode against the golden frames in GOLDEN_DIR.
+//
+// Frame files: a HEADER_SIZE byte header, then each frame as the strips'
+// raw wire-order buffers (strip 1 then strip 2), i.e. exactly what show()
+// would send, after the color LUTs.
+//   [0..3]   "PLFR"
+//   [4]      Format version, FORMAT_VERSION.
+//   [5]      Number of strips.
+//   [6..7]   Strip 1 pixels, LE.   [8]   Strip 1 bytes per pixel.
+//   [9..10]  Strip 2 pixels, LE.   [11]  Strip 2 bytes per pixel.
+//   [12..15] Number of frames, LE.
+namespace GoldenFrames
+{
+  const int HEADER_SIZE = 16;
+  const uint8_t FORMAT_VERSION = 1;
+
+  // Relative to the project root, where pio runs tests from.
+  const char *const GOLDEN_DIR = "test/golden";
+  // Run by the golden frames of ControlMode::Program, as effect-compiler
+  // hex.
+  const char *const GOLDEN_PROGRAM_PATH = "test/golden/program.hex";
+  // Every ControlMode that renders without a keyframe stream.
+  const int NUM_GOLDEN_MODES = ControlMode::Program + 1;
+
+  typedef struct Settings
+  {
+    int mode;
+    uint8_t rgb[3];
+    double seconds;
+    double fps;
+    // LED current budget, as the prop's main sets it; 0 is unlimited.
+    unsigned long budget_ma;
+    const uint8_t *program;
+    int program_length;
+  } Settings;
+
+  // What the golden frames are rendered with: the switch-on transition and
+  // a couple of seconds of the effect.
+  inline Settings golden_settings(int mode, const uint8_t *program, int program_length)
+  {
+    return {mode, {0x28, 0x50, 0xff}, 2., 30., 0, program, program_length};
+  }
+
+  // path: at least 64 bytes.
+  inline void golden_path(char *path, const char *prop, int mode)
+  {
+    snprintf(path, 64, "%s/%s-mode%d.bin", GOLDEN_DIR, prop, mode);
+  }
+
+  inline uint32_t header_frames(const uint8_t *header)
+  {
+    return header[12] | (header[13] << 8) | (header[14] << 16) | ((uint32_t)header[15] << 24);
+  }
+
+  // Reads hex as printed by effect-compiler; whitespace is ignored.
+  // Returns the program's length, or -1 if the file can't be read or
+  // isn't hex.
+  inline int read_program_hex(const char *path, uint8_t *out)
+  {
+    FILE *f = fopen(path, "r");
+    if (!f)
+    {
+      return -1;
+    }
+    int length = 0;
+    int nibbles = 0;
+    int c;
+    while ((c = fgetc(f)) != EOF)
+    {
+      if (isspace(c))
+      {
+        continue;
+      }
+      if (!isxdigit(c) || length == EffectProgram::MAX_SIZE)
+      {
+        fclose(f);
+        return -1;
+      }
+      int v = isdigit(c) ? c - '0' : (tolower(c) - 'a' + 10);
+      out[length] = nibbles % 2 ? (out[length] << 4) | v : v;
+      if (nibbles++ % 2)
+      {
+        length++;
+      }
+    }
+    fclose(f);
+    return length;
+  }
+
+  // One prop's driver, switched on in settings.mode at the start of the
+  // render, on a fixed frame grid. Effect time starts at 0 and the grid on
+  // the next whole millisecond (transitions are timed with millis()), so a
+  // render comes out the same however much simulated time went before it.
+  template <typename Layout>
+  class Renderer
+  {
+  public:
+    typedef typename Layout::Strip1 Strip1;
+    typedef typename Layout::Strip2 Strip2;
+    static const int NUM_STRIPS = Strip2::NUM_PIXELS > 0 ? 2 : 1;
+    static const int FRAME_BYTES = Strip1::NUM_BYTES + Strip2::NUM_BYTES;
+
+    PropLEDDriver<Layout> driver;
+
+    // The fake strips only use the type for their byte count; the driver
+    // writes through the layout's offsets.
+    Renderer(const Settings &settings)
+        : m_settings(settings),
+          m_strip_1(Strip1::NUM_PIXELS, 10, Strip1::BYTES_PER_PIXEL == 4 ? NEO_GRBW : NEO_GRB),
+          m_strip_2(Strip2::NUM_PIXELS, 8, Strip2::BYTES_PER_PIXEL == 4 ? NEO_GRBW : NEO_GRB),
+          m_frame(FRAME_BYTES)
+    {
+      m_strip_1.begin();
+      m_strip_2.begin();
+      driver.register_strips(&m_strip_1, &m_strip_2);
+      driver.m_governor.target_fps = settings.fps;
+      driver.m_current_limiter.budget_ma = settings.budget_ma;
+      m_program_ok = !settings.program || driver.load_program(settings.program, settings.program_length);
+      m_num_frames = (uint32_t)(settings.seconds * settings.fps);
+      m_frame_us = (uint64_t)(1e6 / settings.fps);
+      m_start_us = (NativeSim::time_us() / 1000 + 1) * 1000;
+    }
+
+    // False if settings.program didn't load.
+    bool program_ok() const
+    {
+      return m_program_ok;
+    }
+
+    uint32_t num_frames() const
+    {
+      return m_num_frames;
+    }
+
+    void write_header(uint8_t *header) const
+    {
+      memcpy(header, "PLFR", 4);
+      header[4] = FORMAT_VERSION;
+      header[5] = NUM_STRIPS;
+      header[6] = Strip1::NUM_PIXELS & 0xFF;
+      header[7] = Strip1::NUM_PIXELS >> 8;
+      header[8] = Strip1::BYTES_PER_PIXEL;
+      header[9] = Strip2::NUM_PIXELS & 0xFF;
+      header[10] = Strip2::NUM_PIXELS >> 8;
+      header[11] = Strip2::BYTES_PER_PIXEL;
+      for (int k = 0; k < 4; k++)
+      {
+        header[12 + k] = (m_num_frames >> (8 * k)) & 0xFF;
+      }
+    }
+
+    // Renders the next frame into frame(); false once they're all done.
+    bool next()
+    {
+      if (m_rendered == m_num_frames)
+      {
+        return false;
+      }
+      // show() advances the simulated clock by its transmit time, which
+      // mustn't shift later frames.
+      uint64_t t_us = m_rendered * m_frame_us;
+      NativeSim::set_time_us(m_start_us + t_us);
+      PropLEDDriverBase::ControlInput input = {t_us / 1e6, true,
+                                               {m_settings.rgb[0], m_settings.rgb[1], m_settings.rgb[2]},
+                                               (ControlMode)m_settings.mode};
+      auto start = std::chrono::steady_clock::now();
+      driver.update(input);
+      m_update_ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+      m_peak_ma = max(m_peak_ma, driver.m_current_limiter.estimated_ma());
+
+      memcpy(m_frame.data(), m_strip_1.getPixels(), Strip1::NUM_BYTES);
+      memcpy(m_frame.data() + Strip1::NUM_BYTES, m_strip_2.getPixels(), Strip2::NUM_BYTES);
+      m_rendered++;
+      return true;
+    }
+
+    const uint8_t *frame() const
+    {
+      return m_frame.data();
+    }
+
+    // Host time spent in update() so far, not counting the frame copies.
+    double update_ns() const
+    {
+      return m_update_ns;
+    }
+
+    // Highest estimated LED draw so far, after limiting.
+    float peak_ma() const
+    {
+      return m_peak_ma;
+    }
+
+  private:
+    Settings m_settings;
+    Adafruit_NeoPixel m_strip_1;
+    Adafruit_NeoPixel m_strip_2;
+    std::vector<uint8_t> m_frame;
+    bool m_program_ok = true;
+    uint32_t m_num_frames = 0;
+    uint64_t m_frame_us = 0;
+    uint64_t m_start_us = 0;
+    uint32_t m_rendered = 0;
+    double m_update_ns = 0;
+    float m_peak_ma = 0;
+  };
+
+  typedef struct Comparison
+  {
+    uint32_t frames;
+    uint32_t golden_frames;
+    // Largest difference of any byte of any frame.
+    int max_diff;
+    uint32_t frames_over;
+    // -1 if none.
+    long first_over;
+
+    bool ok() const
+    {
+      return golden_frames == frames && frames_over == 0;
+    }
+  } Comparison;
+
+  // Compares rendered frames, one at a time, against a frame file. A frame
+  // is over tolerance if any byte of it differs by more than tolerance.
+  class Comparer
+  {
+  public:
+    ~Comparer()
+    {
+      if (m_file)
+      {
+        fclose(m_file);
+      }
+    }
+
+    // header: the render's. False if the file can't be read or its strips
+    // aren't the render's.
+    bool open(const char *path, const uint8_t *header, int tolerance)
+    {
+      m_file = fopen(path, "rb");
+      uint8_t golden_header[HEADER_SIZE];
+      if (!m_file || fread(golden_header, 1, HEADER_SIZE, m_file) != HEADER_SIZE || memcmp(golden_header, header, 12))
+      {
+        return false;
+      }
+      m_tolerance = tolerance;
+      m_result = {0, header_frames(golden_header), 0, 0, -1};
+      return true;
+    }
+
+    void add(const uint8_t *frame, int frame_bytes)
+    {
+      uint32_t f = m_result.frames++;
+      m_golden_frame.resize(frame_bytes);
+      if (f >= m_result.golden_frames || fread(m_golden_frame.data(), 1, frame_bytes, m_file) != (size_t)frame_bytes)
+      {
+        return;
+      }
+      int frame_diff = 0;
+      for (int k = 0; k < frame_bytes; k++)
+      {
+        frame_diff = max(frame_diff, abs(frame[k] - m_golden_frame[k]));
+      }
+      m_result.max_diff = max(m_result.max_diff, frame_diff);
+      if (frame_diff > m_tolerance)
+      {
+        m_result.frames_over++;
+        if (m_result.first_over < 0)
+        {
+          m_result.first_over = f;
+        }
+      }
+    }
+
+    const Comparison &result() const
+    {
+      return m_result;
+    }
+
+  private:
+    FILE *m_file = nullptr;
+    int m_tolerance = 0;
+    Comparison m_result = {0, 0, 0, 0, -1};
+    std::vector<uint8_t> m_golden_frame;
+  };
+
+  // Renders all of a render's frames and compares them against the frame
+  // file at path. False in comparison's place if the file can't be used.
+  template <typename Layout>
+  bool compare_render(Renderer<Layout> &renderer, const char *path, int tolerance, Comparison *comparison)
+  {
+    uint8_t header[HEADER_SIZE];
+    renderer.write_header(header);
+    Comparer comparer;
+    if (!comparer.open(path, header, tolerance))
+    {
+      return false;
+    }
+    while (renderer.next())
+    {
+      comparer.add(renderer.frame(), Renderer<Layout>::FRAME_BYTES);
+    }
+    *comparison = comparer.result();
+    return true;
+  }
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Keyframes streamed from the phone for choreographed playback: each one is
+// a color and a ControlMode at a time on the stream's timeline. The phone
+// writes them ahead of time, in batches, without waiting for responses;
+// PropLEDDriver samples the stream every frame and interpolates the color
+// between the two keyframes around the current time.
+//
+// Wire format, KEYFRAME_SIZE bytes each, any number per write:
+//   [0..3]  Time on the stream's timeline, ms, little-endian. A time earlier
+//           than the previous keyframe's, or any keyframe after a
+//           KEYFRAME_END one, starts a new stream.
+//   [4]     Flags: KEYFRAME_ON, KEYFRAME_END.
+//   [5]     ControlMode to render with.
+//   [6..8]  RGB.
+const int KEYFRAME_SIZE = 9;
+const uint8_t KEYFRAME_ON = 0x01;
+// Last keyframe of the stream: hold it, and don't count an underrun.
+const uint8_t KEYFRAME_END = 0x02;
+
+typedef struct Keyframe
+{
+    uint32_t time_ms;
+    uint8_t flags;
+    uint8_t mode;
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+} Keyframe;
+
+class KeyframeStream
+{
+public:
+    static const int CAPACITY = 64; // Power of two.
+
+    // Playback starts this long after the first keyframe arrives, so the
+    // buffer has time to fill.
+    unsigned long lead_ms = 250;
+
+    unsigned long received = 0;
+    // Keyframes dropped because the buffer was full.
+    unsigned long overruns = 0;
+    // Times playback caught up with the last buffered keyframe before the
+    // stream's end.
+    unsigned long underruns = 0;
+
+    int size() const
+    {
+        return m_head - m_tail;
+    }
+
+    void clear()
+    {
+        m_head = m_tail = 0;
+        m_playing = false;
+        m_underrun = false;
+    }
+
+    // Decodes a write of whole keyframes; a trailing partial one is ignored.
+    void push_packed(const uint8_t *data, int length)
+    {
+        for (int offset = 0; offset + KEYFRAME_SIZE <= length; offset += KEYFRAME_SIZE)
+        {
+            const uint8_t *p = data + offset;
+            Keyframe keyframe;
+            keyframe.time_ms = (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+            keyframe.flags = p[4];
+            keyframe.mode = p[5];
+            keyframe.r = p[6];
+            keyframe.g = p[7];
+            keyframe.b = p[8];
+            push(keyframe);
+        }
+    }
+
+    // Returns false if the keyframe was dropped.
+    bool push(const Keyframe &keyframe)
+    {
+        received++;
+        if (m_playing && (keyframe.time_ms < m_last_pushed_ms || m_last_pushed_end))
+        {
+            clear();
+        }
+        if (!m_playing)
+        {
+            m_playing = true;
+            m_origin_ms = millis() + lead_ms - keyframe.time_ms;
+        }
+        if (size() == CAPACITY)
+        {
+            overruns++;
+            return false;
+        }
+        m_buffer[m_head++ & (CAPACITY - 1)] = keyframe;
+        m_last_pushed_ms = keyframe.time_ms;
+        m_last_pushed_end = keyframe.flags & KEYFRAME_END;
+        return true;
+    }
+
+    // Fills out with the stream's state at now_ms: the mode and flags of the
+    // keyframe being played from, and the color blended towards the next
+    // one. Returns false if nothing has been streamed. Keyframes that have
+    // been played past are dropped.
+    bool sample(unsigned long now_ms, Keyframe *out)
+    {
+        if (size() == 0)
+        {
+            return false;
+        }
+        long timeline_ms = (long)(now_ms - m_origin_ms);
+        while (size() >= 2 && (long)at(1).time_ms <= timeline_ms)
+        {
+            m_tail++;
+        }
+
+        const Keyframe &from = at(0);
+        *out = from;
+        if (timeline_ms <= (long)from.time_ms)
+        {
+            return true;
+        }
+        if (size() == 1)
+        {
+            if (!(from.flags & KEYFRAME_END) && !m_underrun)
+            {
+                underruns++;
+            }
+            m_underrun = !(from.flags & KEYFRAME_END);
+            return true;
+        }
+        m_underrun = false;
+
+        const Keyframe &to = at(1);
+        // Q8 blend factor.
+        uint32_t f = ((uint32_t)(timeline_ms - from.time_ms) << 8) / (to.time_ms - from.time_ms);
+        out->r = (from.r * (256 - f) + to.r * f) >> 8;
+        out->g = (from.g * (256 - f) + to.g * f) >> 8;
+        out->b = (from.b * (256 - f) + to.b * f) >> 8;
+        return true;
+    }
+
+private:
+    const Keyframe &at(int i) const
+    {
+        return m_buffer[(m_tail + i) & (CAPACITY - 1)];
+    }
+
+    Keyframe m_buffer[CAPACITY];
+    // Free-running indices; size is their difference.
+    unsigned int m_head = 0;
+    unsigned int m_tail = 0;
+    bool m_playing = false;
+    bool m_underrun = false;
+    uint32_t m_last_pushed_ms = 0;
+    bool m_last_pushed_end = false;
+    unsigned long m_origin_ms = 0;
+};
@@ -1,15 +1,39 @@
 #pragma once
 
 #include <ArduinoBLE.h>
+#include "EffectProgram.h"
+#include "KeyframeStream.h"
+#include "ClockSync.h"
+#include "StageProfiler.h"
 
 typedef enum ControlMode
 {
     DirectRGB = 0,
     DirectRGBPulsing = 1,
     PartyModeFlowing = 2,
-    PartyModeRolling = 3
+    PartyModeRolling = 3,
+    // Runs the effect program uploaded through the program characteristic.
+    Program = 4,
+    // Plays keyframes streamed through the keyframe characteristic.
+    Keyframes = 5
 } ControlMode;
 
+// Packed control state, so the app can change a whole scene with a single
+// GATT write. Little-endian, PACKED_CONTROL_SIZE bytes:
+//   [0..3]   Sequence number. A write is only decoded if this differs from
+//            the last one seen since the central connected (the first write
+//            of a connection always is), so the app should bump it on every
+//            change. After connecting, the app should read the
+//            characteristic first and count on from the sequence there.
+//   [4]      On / off.
+//   [5]      ControlMode.
+//   [6..8]   RGB 1.
+//   [9..11]  RGB 2.
+const int PACKED_CONTROL_SIZE = 12;
+
+// 180 bytes, inside the usual 247 byte MTU.
+const int MAX_KEYFRAMES_PER_WRITE = 20;
+
 class PropBLEManager
 {
 public:
@@ -17,6 +41,22 @@ public:
     uint8_t led_rgb_setting_1[3] = {0, 0, 0};
     uint8_t led_rgb_setting_2[3] = {0, 0, 0}; // unused
     ControlMode control_mode = ControlMode::DirectRGB;
+    uint32_t control_sequence = 0;
+    bool central_connected = false;
+    // Last effect program written by the central; see EffectProgram.h.
+    uint8_t effect_program[EffectProgram::MAX_SIZE];
+    int effect_program_length = 0;
+    // Keyframes written by the central, for ControlMode::Keyframes.
+    KeyframeStream keyframes;
+    // Effect clock, locked to the central's time writes.
+    ClockSync clock_sync;
+    // Advertising interval in 0.625 ms units, slowed to
+    // idle_advertising_interval once no central has been connected for
+    // idle_advertising_after_ms: the radio then wakes a tenth as often, and
+    // the app takes up to a second to find the prop.
+    uint16_t advertising_interval = 160;       // 100 ms
+    uint16_t idle_advertising_interval = 1600; // 1 s
+    unsigned long idle_advertising_after_ms = 60000;
 
     // BLE service info
     BLEService ble_service;
@@ -29,13 +69,42 @@ public:
     BLECharacteristic ble_rgb_2_characteristic; // unused
     // Battery state
     BLEFloatCharacteristic ble_battery_characteristic;
+    // Achieved LED frame rate, for tuning.
+    BLEFloatCharacteristic ble_frame_rate_characteristic;
+    // Estimated LED current draw in mA, after brightness limiting.
+    BLEFloatCharacteristic ble_current_characteristic;
+    // Effect program upload.
+    BLECharacteristic ble_program_characteristic;
+    // Keyframe stream, up to MAX_KEYFRAMES_PER_WRITE keyframes per write.
+    BLECharacteristic ble_keyframe_characteristic;
+    // received, overruns, underruns, buffered: uint32 LE each.
+    BLECharacteristic ble_keyframe_stats_characteristic;
+    // Reference time for ClockSync: uint64 LE microseconds, on any epoch as
+    // long as every prop is sent the same clock.
+    BLECharacteristic ble_time_sync_characteristic;
+    // StageProfiler stats, StageProfiler::RECORD_SIZE bytes per stage up to
+    // the first StageProfiler::PACKED_STRIPS strips' show()s (a long read).
+    BLECharacteristic ble_profile_characteristic;
+    // All of the above controls at once; see PACKED_CONTROL_SIZE. The
+    // individual characteristics are kept for older apps. Variable length,
+    // so a short write shows up as one (a fixed-length characteristic
+    // reports its full size whatever was written) and can be rejected.
+    BLECharacteristic ble_control_characteristic;
 
     PropBLEManager() : ble_service("198a8000-2ab7-414c-9459-47e3d418a7fd"),
                        ble_switch_characteristic("198a8001-2ab7-414c-9459-47e3d418a7fd", BLERead | BLEWrite),
                        ble_mode_characteristic("198a8005-2ab7-414c-9459-47e3d418a7fd", BLERead | BLEWrite),
                        ble_rgb_1_characteristic("198a8002-2ab7-414c-9459-47e3d418a7fd", BLERead | BLEWrite, 3, true),
                        ble_rgb_2_characteristic("198a8004-2ab7-414c-9459-47e3d418a7fd", BLERead | BLEWrite, 3, true),
-                       ble_battery_characteristic("198a8003-2ab7-414c-9459-47e3d418a7fd", BLERead)
+                       ble_battery_characteristic("198a8003-2ab7-414c-9459-47e3d418a7fd", BLERead),
+                       ble_frame_rate_characteristic("198a8007-2ab7-414c-9459-47e3d418a7fd", BLERead),
+                       ble_current_characteristic("198a800d-2ab7-414c-9459-47e3d418a7fd", BLERead),
+                       ble_program_characteristic("198a8008-2ab7-414c-9459-47e3d418a7fd", BLERead | BLEWrite, EffectProgram::MAX_SIZE),
+                       ble_keyframe_characteristic("198a8009-2ab7-414c-9459-47e3d418a7fd", BLEWrite | BLEWriteWithoutResponse, MAX_KEYFRAMES_PER_WRITE * KEYFRAME_SIZE),
+                       ble_keyframe_stats_characteristic("198a800a-2ab7-414c-9459-47e3d418a7fd", BLERead, 16, true),
+                       ble_time_sync_characteristic("198a800b-2ab7-414c-9459-47e3d418a7fd", BLEWrite | BLEWriteWithoutResponse, 8, true),
+                       ble_profile_characteristic("198a800c-2ab7-414c-9459-47e3d418a7fd", BLERead, StageProfiler::PACKED_SIZE, true),
+                       ble_control_characteristic("198a8006-2ab7-414c-9459-47e3d418a7fd", BLERead | BLEWrite, PACKED_CONTROL_SIZE)
 
     {
     }
@@ -46,6 +115,20 @@ public:
         {
             return false;
         }
+        // ArduinoBLE handlers are plain function pointers, so they find us
+        // through here. There's one manager per prop.
+        instance() = this;
+        BLE.setEventHandler(BLEConnected, on_connected);
+        BLE.setEventHandler(BLEDisconnected, on_disconnected);
+        ble_control_characteristic.setEventHandler(BLEWritten, on_control_written);
+        ble_switch_characteristic.setEventHandler(BLEWritten, on_switch_written);
+        ble_rgb_1_characteristic.setEventHandler(BLEWritten, on_rgb_1_written);
+        ble_rgb_2_characteristic.setEventHandler(BLEWritten, on_rgb_2_written);
+        ble_mode_characteristic.setEventHandler(BLEWritten, on_mode_written);
+        ble_program_characteristic.setEventHandler(BLEWritten, on_program_written);
+        ble_keyframe_characteristic.setEventHandler(BLEWritten, on_keyframes_written);
+        ble_time_sync_characteristic.setEventHandler(BLEWritten, on_time_sync_written);
+
         // set advertised local name and service UUID:
         BLE.setLocalName(name);
         BLE.setAdvertisedService(ble_service);
@@ -56,6 +139,14 @@ public:
         ble_service.addCharacteristic(ble_rgb_2_characteristic);
         ble_service.addCharacteristic(ble_battery_characteristic);
         ble_service.addCharacteristic(ble_mode_characteristic);
+        ble_service.addCharacteristic(ble_control_characteristic);
+        ble_service.addCharacteristic(ble_frame_rate_characteristic);
+        ble_service.addCharacteristic(ble_current_characteristic);
+        ble_service.addCharacteristic(ble_program_characteristic);
+        ble_service.addCharacteristic(ble_keyframe_characteristic);
+        ble_service.addCharacteristic(ble_keyframe_stats_characteristic);
+        ble_service.addCharacteristic(ble_time_sync_characteristic);
+        ble_service.addCharacteristic(ble_profile_characteristic);
 
         // add service
         BLE.addService(ble_service);
@@ -65,29 +156,271 @@ public:
         ble_rgb_1_characteristic.writeValue(led_rgb_setting_1, 3);
         ble_rgb_2_characteristic.writeValue(led_rgb_setting_2, 3);
         ble_battery_characteristic.writeValue(-1.23);
+        ble_frame_rate_characteristic.writeValue(0.);
+        ble_current_characteristic.writeValue(0.);
         ble_mode_characteristic.writeValue(control_mode);
+        publish_packed_control();
         // start advertising
+        BLE.setAdvertisingInterval(advertising_interval);
+        m_current_advertising_interval = advertising_interval;
+        m_last_central_ms = millis();
         BLE.advertise();
 
         return true;
     }
 
-    void update(bool force_led_disabled, float battery_voltage)
+    void pack_control(uint8_t *packed)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            packed[i] = (control_sequence >> (8 * i)) & 0xFF;
+        }
+        packed[4] = led_enabled;
+        packed[5] = control_mode;
+        memcpy(&packed[6], led_rgb_setting_1, 3);
+        memcpy(&packed[9], led_rgb_setting_2, 3);
+    }
+
+    static bool valid_control_mode(int mode)
     {
-        // Grab new device if available.
-        BLEDevice central = BLE.central();
+        return mode >= ControlMode::DirectRGB && mode <= ControlMode::Keyframes;
+    }
 
-        if (central && central.connected())
+    // Returns true if the packed state was new and valid, and has been
+    // applied.
+    bool unpack_control(const uint8_t *packed)
+    {
+        uint32_t sequence = 0;
+        for (int i = 0; i < 4; i++)
         {
-            led_enabled = ble_switch_characteristic.value();
-            memcpy(led_rgb_setting_1, ble_rgb_1_characteristic.value(), 3);
-            memcpy(led_rgb_setting_2, ble_rgb_2_characteristic.value(), 3);
-            control_mode = (ControlMode)ble_mode_characteristic.value();
+            sequence |= (uint32_t)packed[i] << (8 * i);
         }
-        if (force_led_disabled)
+        if ((m_control_sequence_seen && sequence == control_sequence) || !valid_control_mode(packed[5]))
         {
-            ble_switch_characteristic.writeValue(led_enabled);
+            return false;
+        }
+        m_control_sequence_seen = true;
+        control_sequence = sequence;
+        led_enabled = packed[4];
+        control_mode = (ControlMode)packed[5];
+        memcpy(led_rgb_setting_1, &packed[6], 3);
+        memcpy(led_rgb_setting_2, &packed[9], 3);
+        return true;
+    }
+
+    void publish_packed_control()
+    {
+        uint8_t packed[PACKED_CONTROL_SIZE];
+        pack_control(packed);
+        ble_control_characteristic.writeValue(packed, PACKED_CONTROL_SIZE);
+    }
+
+    void publish_legacy_controls()
+    {
+        ble_switch_characteristic.writeValue(led_enabled);
+        ble_rgb_1_characteristic.writeValue(led_rgb_setting_1, 3);
+        ble_rgb_2_characteristic.writeValue(led_rgb_setting_2, 3);
+        ble_mode_characteristic.writeValue(control_mode);
+    }
+
+    // Event handlers, run by ArduinoBLE from inside BLE.poll(). They only
+    // decode the written value and flag it; update() does the rest.
+    static PropBLEManager *&instance()
+    {
+        static PropBLEManager *manager = nullptr;
+        return manager;
+    }
+
+    static void on_connected(BLEDevice central)
+    {
+        instance()->central_connected = true;
+        // A new connection may restart its count anywhere, including at the
+        // last sequence seen.
+        instance()->m_control_sequence_seen = false;
+    }
+
+    static void on_disconnected(BLEDevice central)
+    {
+        instance()->central_connected = false;
+        // The idle countdown starts now, even if the central came and went
+        // between updates.
+        instance()->m_last_central_ms = millis();
+    }
+
+    static void on_control_written(BLEDevice central, BLECharacteristic characteristic)
+    {
+        PropBLEManager *manager = instance();
+        if (characteristic.valueLength() == PACKED_CONTROL_SIZE &&
+            manager->unpack_control(characteristic.value()))
+        {
+            manager->m_packed_control_changed = true;
+        }
+    }
+
+    static void on_switch_written(BLEDevice central, BLECharacteristic characteristic)
+    {
+        PropBLEManager *manager = instance();
+        manager->led_enabled = manager->ble_switch_characteristic.value();
+        manager->m_legacy_control_changed = true;
+    }
+
+    static void on_rgb_1_written(BLEDevice central, BLECharacteristic characteristic)
+    {
+        PropBLEManager *manager = instance();
+        memcpy(manager->led_rgb_setting_1, characteristic.value(), 3);
+        manager->m_legacy_control_changed = true;
+    }
+
+    static void on_rgb_2_written(BLEDevice central, BLECharacteristic characteristic)
+    {
+        PropBLEManager *manager = instance();
+        memcpy(manager->led_rgb_setting_2, characteristic.value(), 3);
+        manager->m_legacy_control_changed = true;
+    }
+
+    static void on_mode_written(BLEDevice central, BLECharacteristic characteristic)
+    {
+        PropBLEManager *manager = instance();
+        int mode = manager->ble_mode_characteristic.value();
+        if (!valid_control_mode(mode))
+        {
+            // Put back the mode in use, so readers don't see the bad one.
+            manager->ble_mode_characteristic.writeValue(manager->control_mode);
+            return;
+        }
+        manager->control_mode = (ControlMode)mode;
+        manager->m_legacy_control_changed = true;
+    }
+
+    static void on_program_written(BLEDevice central, BLECharacteristic characteristic)
+    {
+        PropBLEManager *manager = instance();
+        manager->effect_program_length = min(characteristic.valueLength(), (int)EffectProgram::MAX_SIZE);
+        memcpy(manager->effect_program, characteristic.value(), manager->effect_program_length);
+        manager->m_effect_program_uploaded = true;
+    }
+
+    static void on_keyframes_written(BLEDevice central, BLECharacteristic characteristic)
+    {
+        instance()->keyframes.push_packed(characteristic.value(), characteristic.valueLength());
+    }
+
+    static void on_time_sync_written(BLEDevice central, BLECharacteristic characteristic)
+    {
+        if (characteristic.valueLength() != 8)
+        {
+            return;
+        }
+        uint64_t reference_us = 0;
+        for (int i = 0; i < 8; i++)
+        {
+            reference_us |= (uint64_t)characteristic.value()[i] << (8 * i);
         }
+        instance()->clock_sync.add_sample(reference_us);
+    }
+
+    void publish_keyframe_stats()
+    {
+        uint32_t stats[4] = {(uint32_t)keyframes.received, (uint32_t)keyframes.overruns, (uint32_t)keyframes.underruns, (uint32_t)keyframes.size()};
+        uint8_t packed[16];
+        for (int i = 0; i < 16; i++)
+        {
+            packed[i] = (stats[i / 4] >> (8 * (i % 4))) & 0xFF;
+        }
+        ble_keyframe_stats_characteristic.writeValue(packed, 16);
+    }
+
+    void publish_profile()
+    {
+        uint8_t packed[StageProfiler::PACKED_SIZE];
+        StageProfiler::instance().pack(packed);
+        ble_profile_characteristic.writeValue(packed, StageProfiler::PACKED_SIZE);
+    }
+
+    // True once after each program upload; the program is in
+    // effect_program and still needs validating (EffectProgram::load).
+    bool effect_program_uploaded()
+    {
+        bool uploaded = m_effect_program_uploaded;
+        m_effect_program_uploaded = false;
+        return uploaded;
+    }
+
+    // Battery voltage is only written when the caller has something new
+    // to say (see BatteryMonitor::should_publish), not every loop.
+    void publish_battery_voltage(float battery_voltage)
+    {
         ble_battery_characteristic.writeValue(battery_voltage);
     }
+
+    void publish_frame_rate(float fps)
+    {
+        ble_frame_rate_characteristic.writeValue(fps);
+    }
+
+    void publish_current_draw(float ma)
+    {
+        ble_current_characteristic.writeValue(ma);
+    }
+
+    void update(bool force_led_disabled)
+    {
+        StageTimer timer(STAGE_BLE_UPDATE);
+        // Service the radio; this is where the handlers above run.
+        BLE.poll();
+
+        // Keep both views of the controls consistent for readers.
+        if (m_packed_control_changed)
+        {
+            m_packed_control_changed = false;
+            publish_legacy_controls();
+        }
+        if (m_legacy_control_changed)
+        {
+            m_legacy_control_changed = false;
+            publish_packed_control();
+        }
+
+        // Republishes the switch if readers see something other than
+        // led_enabled; a write is a GATT update, so not every tick.
+        if (force_led_disabled && ble_switch_characteristic.value() != led_enabled)
+        {
+            ble_switch_characteristic.writeValue(led_enabled);
+        }
+
+        update_advertising_interval();
+    }
+
+    // The interval advertising currently runs at, in 0.625 ms units.
+    uint16_t current_advertising_interval() const
+    {
+        return m_current_advertising_interval;
+    }
+
+    void update_advertising_interval()
+    {
+        unsigned long t = millis();
+        if (central_connected)
+        {
+            m_last_central_ms = t;
+            return;
+        }
+        uint16_t interval = t - m_last_central_ms >= idle_advertising_after_ms ? idle_advertising_interval
+                                                                               : advertising_interval;
+        if (interval != m_current_advertising_interval)
+        {
+            BLE.stopAdvertise();
+            BLE.setAdvertisingInterval(interval);
+            BLE.advertise();
+            m_current_advertising_interval = interval;
+        }
+    }
+
+private:
+    bool m_packed_control_changed = false;
+    bool m_control_sequence_seen = false;
+    bool m_legacy_control_changed = false;
+    bool m_effect_program_uploaded = false;
+    uint16_t m_current_advertising_interval = 0;
+    unsigned long m_last_central_ms = 0;
 };
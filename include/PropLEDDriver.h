@@ -1,9 +1,175 @@
 #pragma once
 
 #include <Adafruit_NeoPixel.h>
+#include "FixedTrig.h"
+#include "CurrentLimiter.h"
+#include "FrameGovernor.h"
 #include "PropBLEManager.h"
+#include "StageProfiler.h"
+#include "StripOutput.h"
 
-class PropLEDDriver
+// A run of consecutive logical pixels (what effects render) shown on a run of
+// physical pixels, with a per-channel white balance in Q8 (256 == 1.0; the
+// driver folds it into the segment's LUT). Several segments may show the
+// same logical pixels, e.g. to mirror them.
+typedef struct PixelSegment
+{
+  uint16_t logical_start;
+  uint16_t num_pixels;
+  uint16_t physical_start;
+  bool reversed; // Physical index counts down from physical_start.
+  uint16_t scale_r;
+  uint16_t scale_g;
+  uint16_t scale_b;
+} PixelSegment;
+
+// Compile-time description of one strip: pixel count plus the byte layout
+// of a pixel on the wire, decoded from an Adafruit neoPixelType (2 bits each
+// for the W, R, G and B byte offsets; W == R means there's no white byte).
+//
+// As one of a PropLayout's strips, it also says what the strip shows: by
+// default logical pixels LOGICAL_START onwards, one per physical pixel,
+// uncorrected. Descriptors for segmented strips derive from a StripSpec and
+// hide NUM_SEGMENTS, LOGICAL_END and segments() (see SwordLayout.h). Each
+// strip also has a gamma (GAMMA_X100, 100 == linear, which is what the
+// app's colors have always been tuned for), on RGBW strips the share of the
+// common white moved from RGB onto the W LED (WHITE_EXTRACTION, Q8), and
+// whether output is temporally dithered down to 8 bits (DITHER).
+template <uint16_t N_PIXELS, neoPixelType TYPE, uint16_t LOGICAL_START = 0>
+struct StripSpec
+{
+  enum
+  {
+    NUM_PIXELS = N_PIXELS,
+    W_OFFSET = (TYPE >> 6) & 0b11,
+    R_OFFSET = (TYPE >> 4) & 0b11,
+    G_OFFSET = (TYPE >> 2) & 0b11,
+    B_OFFSET = TYPE & 0b11,
+    BYTES_PER_PIXEL = (W_OFFSET == R_OFFSET) ? 3 : 4,
+    NUM_BYTES = NUM_PIXELS * BYTES_PER_PIXEL,
+    // One past the last logical pixel the strip shows.
+    LOGICAL_END = LOGICAL_START + N_PIXELS,
+    NUM_SEGMENTS = 1,
+    GAMMA_X100 = 100,
+    WHITE_EXTRACTION = 256,
+    DITHER = 1
+  };
+
+  static const PixelSegment *segments()
+  {
+    static const PixelSegment segments[] = {{LOGICAL_START, N_PIXELS, 0, false, 256, 256, 256}};
+    return segments;
+  }
+
+  // Writes pixel i straight into the strip's wire-order buffer, skipping
+  // Adafruit's per-call byte order lookup (and its brightness scaling, which
+  // no prop uses). i must be < NUM_PIXELS; w is dropped on RGB strips.
+  static inline void set(uint8_t *pixels, int i, uint8_t r, uint8_t g, uint8_t b, uint8_t w = 0)
+  {
+    uint8_t *p = pixels + i * BYTES_PER_PIXEL;
+    p[R_OFFSET] = r;
+    p[G_OFFSET] = g;
+    p[B_OFFSET] = b;
+    if (BYTES_PER_PIXEL == 4)
+    {
+      p[W_OFFSET] = w;
+    }
+  }
+
+  // Repeats the wire-order pixel at pattern over count pixels from start,
+  // doubling the span each copy. pattern may be pixel start itself.
+  static inline void fill(uint8_t *pixels, int start, int count, const uint8_t *pattern)
+  {
+    if (count <= 0)
+    {
+      return;
+    }
+    uint8_t *p = pixels + start * BYTES_PER_PIXEL;
+    if (p != pattern)
+    {
+      memcpy(p, pattern, BYTES_PER_PIXEL);
+    }
+    for (int filled = 1; filled < count;)
+    {
+      int n = min(filled, count - filled);
+      memcpy(p + filled * BYTES_PER_PIXEL, p, n * BYTES_PER_PIXEL);
+      filled += n;
+    }
+  }
+};
+
+// Stands in for Strip2 of single-strip layouts.
+typedef StripSpec<0, NEO_GRB> NoStrip;
+
+// The K-th of STRIPS, or NoStrip past the end.
+template <int K, typename... STRIPS>
+struct StripAt
+{
+  typedef NoStrip type;
+};
+template <int K, typename FIRST, typename... REST>
+struct StripAt<K, FIRST, REST...>
+{
+  typedef typename StripAt<K - 1, REST...>::type type;
+};
+template <typename FIRST, typename... REST>
+struct StripAt<0, FIRST, REST...>
+{
+  typedef FIRST type;
+};
+
+// Logical and physical extent of STRIPS together.
+template <typename... STRIPS>
+struct StripTotals
+{
+  enum
+  {
+    LOGICAL_END = 0,
+    NUM_PIXELS = 0
+  };
+};
+template <typename FIRST, typename... REST>
+struct StripTotals<FIRST, REST...>
+{
+  enum
+  {
+    LOGICAL_END = (int)FIRST::LOGICAL_END > (int)StripTotals<REST...>::LOGICAL_END
+                      ? (int)FIRST::LOGICAL_END
+                      : (int)StripTotals<REST...>::LOGICAL_END,
+    NUM_PIXELS = FIRST::NUM_PIXELS + StripTotals<REST...>::NUM_PIXELS
+  };
+};
+
+// Compile-time registry of a prop's strips, in the order they're registered
+// with the driver: each a StripSpec or a descriptor derived from one.
+// Effects render one logical framebuffer of LOGICAL_PIXELS pixels, and each
+// strip's segments say which of them it shows. Strips showing the same
+// logical pixels mirror each other (plain StripSpecs all start at 0, as the
+// props' paired strips always have); give them different LOGICAL_STARTs to
+// lay them end to end.
+template <typename... STRIPS>
+struct PropLayout
+{
+  enum
+  {
+    NUM_STRIPS = sizeof...(STRIPS),
+    LOGICAL_PIXELS = StripTotals<STRIPS...>::LOGICAL_END,
+    PHYSICAL_PIXELS = StripTotals<STRIPS...>::NUM_PIXELS
+  };
+
+  template <int K>
+  using Strip = typename StripAt<K, STRIPS...>::type;
+  // For props and tools with one or two strips.
+  typedef Strip<0> Strip1;
+  typedef Strip<1> Strip2;
+
+  // LIST<the strips>, e.g. the driver's per-strip state.
+  template <template <typename...> class LIST>
+  using Strips = LIST<STRIPS...>;
+};
+
+// Layout-independent types shared by every PropLEDDriver<Layout>.
+class PropLEDDriverBase
 {
 public:
   // This struct maps 1-to-1 with state coming in from Bluetooth. It's a superset of
@@ -14,6 +180,61 @@ public:
     uint8_t g;
     uint8_t b;
   } Color;
+  // What effects render: 16 bits per channel, 65535 == full, so dim colors
+  // and slow fades keep their precision until the output stage.
+  typedef struct Color16
+  {
+    uint16_t r;
+    uint16_t g;
+    uint16_t b;
+  } Color16;
+
+  static inline Color16 widen(Color c)
+  {
+    return {(uint16_t)(c.r * 257), (uint16_t)(c.g * 257), (uint16_t)(c.b * 257)};
+  }
+
+  // How a mode change blends from the outgoing effect to the incoming one.
+  typedef enum TransitionType
+  {
+    Crossfade = 0,
+    // The incoming effect sweeps up from logical pixel 0, with a one pixel
+    // soft edge.
+    Wipe = 1
+  } TransitionType;
+
+  // a + (b - a) * f, f in Q15 (32768 == all b).
+  static inline uint16_t mix_channel(uint16_t a, uint16_t b, int32_t f_q15)
+  {
+    return a + (((b - a) * f_q15) >> 15);
+  }
+
+  static inline Color16 mix(Color16 a, Color16 b, int32_t f_q15)
+  {
+    return {mix_channel(a.r, b.r, f_q15), mix_channel(a.g, b.g, f_q15), mix_channel(a.b, b.b, f_q15)};
+  }
+
+  // Blends n pixels of the outgoing effect into the incoming one, in place,
+  // at progress f (Q15).
+  static void blend_transition(TransitionType type, const Color16 *outgoing, Color16 *incoming, int n, int32_t f_q15)
+  {
+    if (type == Wipe)
+    {
+      // Edge position in Q8 pixels; pixels behind it show the incoming effect.
+      int32_t edge_q8 = (f_q15 * n) >> 7;
+      for (int i = 0; i < n; i++)
+      {
+        int32_t coverage = constrain(edge_q8 - (i << 8), 0, 256);
+        incoming[i] = mix(outgoing[i], incoming[i], coverage << 7);
+      }
+      return;
+    }
+    for (int i = 0; i < n; i++)
+    {
+      incoming[i] = mix(outgoing[i], incoming[i], f_q15);
+    }
+  }
+
   typedef struct ControlInput
   {
     double t; // Seconds, arbitrary 0 point.
@@ -22,124 +243,655 @@ public:
     ControlMode control_mode;
   } ControlInput;
 
-  Adafruit_NeoPixel *m_pixels_1;
-  Adafruit_NeoPixel *m_pixels_2;
-  PropLEDDriver()
+  // Frames are rendered every update(), but show() blocks interrupts for
+  // ~30us per pixel, so a strip is only pushed when its contents changed
+  // since the last push. Tracked by hashing the strip's pixel buffer.
+  typedef struct StripState
+  {
+    bool pushed; // False until the first show(), so the first frame always goes out.
+    uint32_t hash;
+  } StripState;
+
+  typedef struct FrameStats
+  {
+    unsigned long frames_rendered;
+    unsigned long frames_pushed; // Summed over the strips.
+  } FrameStats;
+
+  // One entry per physical pixel: the logical pixel it shows and the
+  // segment whose correction applies. Built once from the layout's segments.
+  typedef struct PixelMapEntry
+  {
+    uint16_t logical; // NO_LOGICAL_PIXEL leaves the pixel dark.
+    uint8_t segment;
+  } PixelMapEntry;
+  enum
   {
+    NO_LOGICAL_PIXEL = 0xFFFF
+  };
+
+  // Consecutive physical pixels on the same segment (or all dark), so a
+  // frame that's one color everywhere can be written a span at a time.
+  typedef struct PixelRun
+  {
+    uint16_t start;
+    uint16_t count;
+    uint8_t segment; // NO_SEGMENT for dark pixels.
+  } PixelRun;
+  enum
+  {
+    NO_SEGMENT = 0xFF
+  };
+
+  // Returns the number of runs, at most max_runs (2 * segments + 1 always
+  // fits: each segment splits at most one run in three).
+  static int build_pixel_runs(const PixelMapEntry *map, int num_physical, PixelRun *runs, int max_runs)
+  {
+    int n = 0;
+    for (int p = 0; p < num_physical; p++)
+    {
+      uint8_t segment = map[p].logical == NO_LOGICAL_PIXEL ? (uint8_t)NO_SEGMENT : map[p].segment;
+      if (n > 0 && runs[n - 1].segment == segment)
+      {
+        runs[n - 1].count++;
+      }
+      else if (n < max_runs)
+      {
+        runs[n++] = {(uint16_t)p, 1, segment};
+      }
+      else
+      {
+        break;
+      }
+    }
+    return n;
   }
 
-  // Hacky support to "grow" into a new mode
-  // by updating more and more pixels as the mode
-  // begins.
-  unsigned long m_last_mode_change_ms = 0;
-  ControlMode m_last_control_mode;
-  unsigned long get_millis_since_last_mode_change()
+  static void build_pixel_map(const PixelSegment *segments, int num_segments, PixelMapEntry *map, int num_physical)
   {
-    return millis() - m_last_mode_change_ms;
+    for (int p = 0; p < num_physical; p++)
+    {
+      map[p] = {NO_LOGICAL_PIXEL, 0};
+    }
+    for (int s = 0; s < num_segments; s++)
+    {
+      for (int k = 0; k < segments[s].num_pixels; k++)
+      {
+        int p = segments[s].reversed ? segments[s].physical_start - k : segments[s].physical_start + k;
+        if (p >= 0 && p < num_physical)
+        {
+          map[p] = {(uint16_t)(segments[s].logical_start + k), (uint8_t)s};
+        }
+      }
+    }
   }
-  const int MS_PER_PIXEL = 25;
-  int get_num_leds_to_update(const Adafruit_NeoPixel& pixels){
-    int num_to_update = get_millis_since_last_mode_change() / MS_PER_PIXEL;
-    return max(min(num_to_update, pixels.numPixels()), 0);
+
+  // Per-segment color correction: gamma, then the segment's white balance,
+  // folded into one table per channel. Entry k is the output for a 16-bit
+  // channel of k << 8 (see lookup()), as a Q8 output level: 0..MAX_LEVEL,
+  // i.e. the 8-bit value plus the fraction dithering spreads over frames.
+  enum
+  {
+    LUT_SIZE = 257,
+    MAX_LEVEL = 255 << 8
+  };
+  typedef struct ColorLUT
+  {
+    uint16_t r[LUT_SIZE];
+    uint16_t g[LUT_SIZE];
+    uint16_t b[LUT_SIZE];
+  } ColorLUT;
+
+  static void build_luts(const PixelSegment *segments, int num_segments, int gamma_x100, ColorLUT *luts)
+  {
+    uint32_t gamma[LUT_SIZE];
+    for (int k = 0; k < LUT_SIZE; k++)
+    {
+      gamma[k] = (uint32_t)(MAX_LEVEL * pow(min((k << 8) / 65535., 1.), gamma_x100 / 100.) + 0.5);
+    }
+    for (int s = 0; s < num_segments; s++)
+    {
+      for (int k = 0; k < LUT_SIZE; k++)
+      {
+        luts[s].r[k] = min((gamma[k] * segments[s].scale_r) >> 8, (uint32_t)MAX_LEVEL);
+        luts[s].g[k] = min((gamma[k] * segments[s].scale_g) >> 8, (uint32_t)MAX_LEVEL);
+        luts[s].b[k] = min((gamma[k] * segments[s].scale_b) >> 8, (uint32_t)MAX_LEVEL);
+      }
+    }
   }
 
-  void register_strips(Adafruit_NeoPixel *pixels_1, Adafruit_NeoPixel *pixels_2)
+  // Looks up a 16-bit channel: the top 8 bits pick the entry, and the low 8
+  // interpolate towards the next one (tables are monotonic).
+  static inline uint16_t lookup(const uint16_t *table, uint16_t v)
   {
-    m_pixels_1 = pixels_1;
-    m_pixels_2 = pixels_2;
+    int k = v >> 8;
+    return table[k] + (((table[k + 1] - table[k]) * (v & 0xFF)) >> 8);
   }
 
-  // Overload these for special handling, e.g. sword blade. Assumes relevant strip exists.
-  virtual inline void setPixels1Color(int i, uint8_t r, uint8_t g, uint8_t b)
+  // Quantizes a Q8 output level to 8 bits. With dithering, the fraction
+  // left over is carried to the same channel's next frame (per-pixel,
+  // frame-to-frame error diffusion), so a level between two steps
+  // alternates between them in the right proportion instead of rounding
+  // to one of them; at 60 fps that's not visible as flicker.
+  template <int DITHER>
+  static inline uint8_t quantize(uint16_t level, uint8_t &error)
   {
-    m_pixels_1->setPixelColor(i, r, g, b);
+    if (!DITHER)
+    {
+      return (level + 0x80) >> 8;
+    }
+    // level <= MAX_LEVEL, so this can't carry past 255.
+    uint16_t sum = level + error;
+    error = sum & 0xFF;
+    return sum >> 8;
   }
-  virtual inline void setPixels2Color(int i, uint8_t r, uint8_t g, uint8_t b)
+
+  // Corrects c through its segment's LUT into physical pixel p's output
+  // levels, in the strip's wire order. On RGBW strips, WHITE_EXTRACTION
+  // (Q8) of the white common to R, G and B is moved onto the W LED. Returns
+  // the sum of the channel levels, for the current limiter.
+  template <typename Strip, int WHITE_EXTRACTION>
+  static inline uint32_t correct_pixel(Color16 c, const ColorLUT &lut, uint16_t *levels, int p)
   {
-    m_pixels_2->setPixelColor(i, r, g, b);
+    uint16_t r = lookup(lut.r, c.r), g = lookup(lut.g, c.g), b = lookup(lut.b, c.b);
+    uint16_t *level = levels + p * Strip::BYTES_PER_PIXEL;
+    if (Strip::BYTES_PER_PIXEL == 4)
+    {
+      uint16_t w = (min(r, min(g, b)) * WHITE_EXTRACTION) >> 8;
+      level[Strip::R_OFFSET] = r - w;
+      level[Strip::G_OFFSET] = g - w;
+      level[Strip::B_OFFSET] = b - w;
+      level[Strip::W_OFFSET] = w;
+      return r + g + b - 2 * w;
+    }
+    level[Strip::R_OFFSET] = r;
+    level[Strip::G_OFFSET] = g;
+    level[Strip::B_OFFSET] = b;
+    return r + g + b;
   }
 
-  void turn_off_all_leds()
+  // Single linear pass over a strip, correcting each physical pixel from
+  // the logical framebuffer through correct_pixel().
+  template <typename Strip, int WHITE_EXTRACTION>
+  static inline uint32_t correct_pixel_map(const Color16 *logical, const PixelMapEntry *map, const ColorLUT *luts,
+                                           uint16_t *levels)
   {
-    if (m_pixels_1)
+    uint32_t level_sum = 0;
+    for (int p = 0; p < Strip::NUM_PIXELS; p++)
     {
-      for (int i = 0; i <= m_pixels_1->numPixels(); i++)
+      PixelMapEntry e = map[p];
+      if (e.logical == NO_LOGICAL_PIXEL)
       {
-        setPixels1Color(i, 0, 0, 0);
+        memset(levels + p * Strip::BYTES_PER_PIXEL, 0, Strip::BYTES_PER_PIXEL * sizeof(uint16_t));
+        continue;
       }
-      m_pixels_1->show();
+      level_sum += correct_pixel<Strip, WHITE_EXTRACTION>(logical[e.logical], luts[e.segment], levels, p);
     }
-    if (m_pixels_2)
+    return level_sum;
+  }
+
+  // correct_pixel_map() for a frame that's c everywhere: only the first
+  // pixel of each run is corrected, for quantize_solid() to fill the run
+  // from.
+  template <typename Strip, int WHITE_EXTRACTION>
+  static inline uint32_t correct_solid(Color16 c, const PixelRun *runs, int num_runs, const ColorLUT *luts,
+                                       uint16_t *levels)
+  {
+    uint32_t level_sum = 0;
+    for (int k = 0; k < num_runs; k++)
     {
-      for (int i = 0; i <= m_pixels_2->numPixels(); i++)
+      const PixelRun &run = runs[k];
+      if (run.segment != NO_SEGMENT)
       {
-        setPixels2Color(i, 0, 0, 0);
+        level_sum += run.count * correct_pixel<Strip, WHITE_EXTRACTION>(c, luts[run.segment], levels, run.start);
       }
-      m_pixels_2->show();
     }
+    return level_sum;
   }
 
-  void update_direct_rgb(ControlInput input)
+  // Scales a strip's corrected levels by the current limiter's scale (Q16)
+  // and quantizes them into its wire-order buffer. The buffers never
+  // overlap; saying so lets the compiler unroll (or on the host vectorize)
+  // the loop, which otherwise has to reload through every byte store.
+  template <typename Strip, int DITHER>
+  static inline void quantize_levels(const uint16_t *__restrict levels, uint32_t scale_q16,
+                                     uint8_t *__restrict errors, uint8_t *__restrict pixels)
   {
-    if (m_pixels_1)
+    for (int i = 0; i < Strip::NUM_BYTES; i++)
     {
-      for (int i = 0; i <= get_num_leds_to_update(*m_pixels_1); i++)
-      {
-        setPixels1Color(i, input.color.r, input.color.g, input.color.b);
-      }
-      m_pixels_1->show();
+      pixels[i] = quantize<DITHER>((levels[i] * scale_q16) >> 16, errors[i]);
     }
-    if (m_pixels_2)
+  }
+
+  // quantize_levels() after correct_solid(): quantizes one pixel per run
+  // and fills the rest of the run with it. Its dithering error is copied
+  // along too, so the run's pixels dither in step; coming out of a
+  // non-solid frame, that can move the others by one level for a frame.
+  template <typename Strip, int DITHER>
+  static inline void quantize_solid(const uint16_t *levels, const PixelRun *runs, int num_runs, uint32_t scale_q16,
+                                    uint8_t *errors, uint8_t *pixels)
+  {
+    for (int k = 0; k < num_runs; k++)
     {
-      for (int i = 0; i <= get_num_leds_to_update(*m_pixels_2); i++)
+      const PixelRun &run = runs[k];
+      uint8_t *p = pixels + run.start * Strip::BYTES_PER_PIXEL;
+      if (run.segment == NO_SEGMENT)
       {
-        setPixels2Color(i, input.color.r, input.color.g, input.color.b);
+        memset(p, 0, run.count * Strip::BYTES_PER_PIXEL);
+        continue;
       }
-      m_pixels_2->show();
+      const uint16_t *level = levels + run.start * Strip::BYTES_PER_PIXEL;
+      uint8_t *error = errors + run.start * Strip::BYTES_PER_PIXEL;
+      for (int i = 0; i < Strip::BYTES_PER_PIXEL; i++)
+      {
+        p[i] = quantize<DITHER>((level[i] * scale_q16) >> 16, error[i]);
+      }
+      Strip::fill(pixels, run.start, run.count, p);
+      Strip::fill(errors, run.start, run.count, error);
     }
   }
 
-  inline float get_pulsing_noise(float x, float t)
+  // FNV-1a over a strip's wire-order buffer.
+  static uint32_t hash_bytes(const uint8_t *bytes, int n)
   {
-    return ((cos(2 * x + t) * sin(x - 0.5 * t)) + 1) / 2.;
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < n; i++)
+    {
+      hash ^= bytes[i];
+      hash *= 16777619u;
+    }
+    return hash;
   }
+};
 
-  void update_direct_rgb_pulsing(ControlInput input)
+// What PropLEDDriver keeps for one of its layout's strips, and the
+// per-strip stages of a frame.
+template <typename Strip>
+struct StripSlot
+{
+  typedef PropLEDDriverBase Base;
+
+  Adafruit_NeoPixel *pixels = nullptr;
+  // The strip's own show() unless registered with another output.
+  StripOutput *output = nullptr;
+  BlockingStripOutput blocking;
+  Base::StripState state = {false, 0};
+  Base::PixelMapEntry map[Strip::NUM_PIXELS];
+  Base::PixelRun runs[2 * Strip::NUM_SEGMENTS + 1];
+  int num_runs = 0;
+  Base::ColorLUT luts[Strip::NUM_SEGMENTS];
+  // The frame being written, color corrected but not yet scaled or
+  // quantized, per byte of the strip buffer; after a solid frame only each
+  // run's first pixel is written.
+  uint16_t levels[Strip::NUM_BYTES];
+  // Dithering error carried between frames, per byte of the strip buffer.
+  uint8_t dither_error[Strip::NUM_BYTES];
+  // Whether levels holds a solid frame.
+  bool solid = false;
+  // The last frame's limiter scale (see quantize_frame()).
+  uint32_t last_scale_q16 = 0;
+
+  StripSlot()
   {
-    // Same as direct_rgb, but apply a time-varying pulsing effect to make the sword look more
-    // organic.
-    const float dim_amount = 0.75;
+    memset(levels, 0, sizeof(levels));
+    memset(dither_error, 0, sizeof(dither_error));
+    Base::build_pixel_map(Strip::segments(), Strip::NUM_SEGMENTS, map, Strip::NUM_PIXELS);
+    num_runs = Base::build_pixel_runs(map, Strip::NUM_PIXELS, runs, 2 * Strip::NUM_SEGMENTS + 1);
+    Base::build_luts(Strip::segments(), Strip::NUM_SEGMENTS, Strip::GAMMA_X100, luts);
+  }
 
-    if (m_pixels_1)
+  // Returns false if strip_pixels doesn't match Strip.
+  bool attach(Adafruit_NeoPixel *strip_pixels, StripOutput *strip_output)
+  {
+    if (!strip_pixels || strip_pixels->numPixels() != Strip::NUM_PIXELS)
     {
-      for (int i = 0; i <= get_num_leds_to_update(*m_pixels_1); i++)
-      {
+      return false;
+    }
+    pixels = strip_pixels;
+    blocking.m_strip = pixels;
+    output = strip_output ? strip_output : &blocking;
+    state = {false, 0};
+    return true;
+  }
 
-        float x = ((float)i) / 20.;
-        float scale = 1. - dim_amount * get_pulsing_noise(x, input.t);
-        setPixels1Color(i, scale * input.color.r, scale * input.color.g, scale * input.color.b);
-      }
-      m_pixels_1->show();
+  // First half of writing a frame into the strip's buffer: corrects the
+  // logical framebuffer through the pixel map, or solid_color everywhere if
+  // solid, into levels. Returns the level sum, so the current limiter can
+  // fit the frame's scale before anything is quantized.
+  uint32_t correct_frame(const Base::Color16 *logical, bool frame_solid, Base::Color16 solid_color)
+  {
+    solid = frame_solid;
+    if (solid)
+    {
+      return Base::correct_solid<Strip, Strip::WHITE_EXTRACTION>(solid_color, runs, num_runs, luts, levels);
+    }
+    return Base::correct_pixel_map<Strip, Strip::WHITE_EXTRACTION>(logical, map, luts, levels);
+  }
+
+  // Second half: quantizes the corrected levels at scale_q16.
+  //
+  // Dithering keeps a level between two steps alternating between them, so
+  // a strip showing a still frame would still change, and be pushed, most
+  // frames. So a frame whose logical framebuffer (logical_unchanged) and
+  // scale are the same as the last one's is rounded instead: after at most
+  // one more push the strip holds still, at the cost of the still frame
+  // losing the fraction dithering would have shown. The error is kept, and
+  // dithering picks up from it when the frame next changes.
+  void quantize_frame(uint32_t scale_q16, bool logical_unchanged)
+  {
+    bool round = logical_unchanged && state.pushed && scale_q16 == last_scale_q16;
+    last_scale_q16 = scale_q16;
+    if (round)
+    {
+      quantize_frame_as<0>(scale_q16);
+    }
+    else
+    {
+      quantize_frame_as<Strip::DITHER>(scale_q16);
+    }
+  }
+
+  template <int DITHER>
+  void quantize_frame_as(uint32_t scale_q16)
+  {
+    if (solid)
+    {
+      Base::quantize_solid<Strip, DITHER>(levels, runs, num_runs, scale_q16, dither_error, pixels->getPixels());
+    }
+    else
+    {
+      Base::quantize_levels<Strip, DITHER>(levels, scale_q16, dither_error, pixels->getPixels());
+    }
+  }
+
+  // Returns true if the strip was pushed.
+  bool show_if_dirty(ProfileStage stage)
+  {
+    uint32_t hash = Base::hash_bytes(pixels->getPixels(), Strip::NUM_BYTES);
+    if (state.pushed && hash == state.hash)
+    {
+      return false;
+    }
+    StageTimer timer(stage);
+    output->show();
+    state.pushed = true;
+    state.hash = hash;
+    return true;
+  }
+};
+
+// A StripSlot per strip, first to last. for_each(fn) calls fn(slot, k) on
+// each, so per-strip work is one loop body however many strips there are,
+// still compiled for each strip's own layout.
+template <typename... STRIPS>
+struct StripSlots
+{
+  template <typename Fn>
+  void for_each(Fn &&, int = 0)
+  {
+  }
+};
+template <typename FIRST, typename... REST>
+struct StripSlots<FIRST, REST...>
+{
+  StripSlot<FIRST> first;
+  StripSlots<REST...> rest;
+
+  template <typename Fn>
+  void for_each(Fn &&fn, int k = 0)
+  {
+    fn(first, k);
+    rest.for_each(fn, k + 1);
+  }
+};
+
+// Renders the ControlMode effects onto a prop's strips. The Layout fixes the
+// strip count, pixel counts, color orders and segment map at compile time, so
+// the per-pixel loops inline down to plain buffer reads and writes.
+template <typename Layout>
+class PropLEDDriver : public PropLEDDriverBase
+{
+  static_assert(Layout::NUM_STRIPS <= MAX_PROFILED_STRIPS, "Too many strips for the profiler's show stages");
+
+public:
+  typedef typename Layout::template Strips<StripSlots> Slots;
+
+  Slots m_strips;
+  // Set once every strip is registered.
+  bool m_ready = false;
+
+  // What effects render into; mapped onto the strips once per frame.
+  Color16 m_logical[Layout::LOGICAL_PIXELS];
+  // The outgoing effect during a transition, blended into the above.
+  Color16 m_outgoing_frame[Layout::LOGICAL_PIXELS];
+  // Which of the above render() and turn_off_all_leds() write to.
+  Color16 *m_target = m_logical;
+
+  PropLEDDriver()
+  {
+    memset(m_logical, 0, sizeof(m_logical));
+    memset(m_outgoing_frame, 0, sizeof(m_outgoing_frame));
+    memset(m_last_logical, 0, sizeof(m_last_logical));
+  }
+
+  // Mode changes, including switching on and off, blend from the outgoing
+  // effect to the incoming one over m_transition_ms, with both still
+  // animating. A change during a transition starts a new one from the
+  // previous incoming effect.
+  TransitionType m_transition_type = Wipe;
+  unsigned long m_transition_ms = 1000;
+  // Starts off, so switching on fades in.
+  ControlInput m_current = {0., false, {0, 0, 0}, ControlMode::DirectRGB};
+  ControlInput m_outgoing = {0., false, {0, 0, 0}, ControlMode::DirectRGB};
+  bool m_transitioning = false;
+  unsigned long m_transition_start_ms = 0;
+
+  bool in_transition()
+  {
+    if (m_transitioning && millis() - m_transition_start_ms >= m_transition_ms)
+    {
+      m_transitioning = false;
+    }
+    return m_transitioning;
+  }
+
+  void start_transition_if_changed(ControlInput input)
+  {
+    bool changed = input.on_off != m_current.on_off || (input.on_off && input.control_mode != m_current.control_mode);
+    if (changed && m_transition_ms > 0)
+    {
+      m_outgoing = m_current;
+      m_transitioning = true;
+      m_transition_start_ms = millis();
+    }
+    m_current = input;
+  }
+
+  // Registers strip k of the layout, with the output to send its frames
+  // through. Returns false if k is out of range or the strip doesn't match.
+  // update() does nothing until every strip is registered. With an
+  // AsyncStripOutput per strip, each frame is rendered while the previous
+  // one is still going out, and the strips go out concurrently.
+  bool register_strip(int k, Adafruit_NeoPixel *pixels, StripOutput *output = nullptr)
+  {
+    bool attached = false;
+    bool ready = true;
+    m_strips.for_each([&](auto &slot, int i)
+                      {
+                        if (i == k)
+                        {
+                          attached = slot.attach(pixels, output);
+                        }
+                        ready = ready && slot.pixels;
+                      });
+    m_ready = ready;
+    return attached;
+  }
+
+  // The first two strips, for props with one or two.
+  bool register_strips(Adafruit_NeoPixel *pixels_1, Adafruit_NeoPixel *pixels_2,
+                       StripOutput *output_1 = nullptr, StripOutput *output_2 = nullptr)
+  {
+    bool registered = register_strip(0, pixels_1, output_1);
+    if (Layout::NUM_STRIPS > 1)
+    {
+      registered = register_strip(1, pixels_2, output_2) && registered;
     }
-    if (m_pixels_2)
+    return registered;
+  }
+
+  FrameStats m_frame_stats = {0, 0};
+  // Times each update() and picks the render quality. Set
+  // m_governor.target_fps to the rate update() is called at.
+  FrameGovernor m_governor;
+
+  void show_dirty_strips()
+  {
+    m_frame_stats.frames_rendered++;
+    m_strips.for_each([&](auto &slot, int k)
+                      {
+                        if (slot.show_if_dirty((ProfileStage)(STAGE_SHOW_1 + k)))
+                        {
+                          m_frame_stats.frames_pushed++;
+                        }
+                      });
+  }
+
+  static inline Color16 average(Color16 a, Color16 b)
+  {
+    return {(uint16_t)((a.r + b.r + 1) >> 1), (uint16_t)((a.g + b.g + 1) >> 1), (uint16_t)((a.b + b.b + 1) >> 1)};
+  }
+
+  // Writes color_at(i) to the first n pixels of a logical framebuffer. At
+  // half resolution, only even pixels are evaluated and odd pixels are the
+  // average of their neighbours.
+  template <typename ColorFn>
+  inline void render_pixels(Color16 *logical, int n, ColorFn color_at)
+  {
+    if (m_governor.quality() == FrameGovernor::FullResolution)
     {
-      for (int i = 0; i <= get_num_leds_to_update(*m_pixels_2); i++)
+      for (int i = 0; i < n; i++)
       {
-        float x = ((float)i) / 20.;
-        float scale = 1. - dim_amount * get_pulsing_noise(x, input.t);
-        setPixels2Color(i, scale * input.color.r, scale * input.color.g, scale * input.color.b);
+        logical[i] = color_at(i);
       }
-      m_pixels_2->show();
+      return;
+    }
+    for (int i = 0; i < n; i += 2)
+    {
+      logical[i] = color_at(i);
+    }
+    for (int i = 1; i < n; i += 2)
+    {
+      logical[i] = (i + 1 < n) ? average(logical[i - 1], logical[i + 1]) : logical[i - 1];
     }
   }
 
+  // Set when this frame's effect rendered one color everywhere, so the
+  // pixel map can fill spans (correct_solid()) instead of converting every
+  // pixel. m_solid_fill = false always takes the per-pixel path, e.g. for
+  // benchmarking.
+  bool m_solid = false;
+  bool m_solid_fill = true;
+  Color16 m_solid_color = {0, 0, 0};
+
+  // render() for effects that are one color everywhere. The logical
+  // framebuffers are still written, for transitions to blend.
+  inline void render_solid(Color16 c)
+  {
+    render([&](int i)
+           { return c; });
+    if (m_target == m_logical)
+    {
+      m_solid = true;
+      m_solid_color = c;
+    }
+  }
+
+  // Writes color_at(i) to every logical pixel of the target framebuffer,
+  // whichever strips show it.
+  template <typename ColorFn>
+  inline void render(ColorFn color_at)
+  {
+    render_pixels(m_target, Layout::LOGICAL_PIXELS, color_at);
+  }
+
+  // Keeps the estimated draw of all strips under m_current_limiter.budget_ma.
+  CurrentLimiter m_current_limiter;
+
+  // The last frame's logical framebuffer, to tell still frames from
+  // animated ones whichever path rendered them. A straight compare rather
+  // than a hash: an animated frame differs within its first few pixels,
+  // and a still one only costs a memcmp.
+  Color16 m_last_logical[Layout::LOGICAL_PIXELS];
+
+  // Corrects every strip's pixels, fits the limiter's scale to the
+  // frame's level sum, then quantizes them all at that scale.
+  void apply_pixel_maps()
+  {
+    bool solid = m_solid && m_solid_fill;
+    bool logical_unchanged = !memcmp(m_logical, m_last_logical, sizeof(m_logical));
+    if (!logical_unchanged)
+    {
+      memcpy(m_last_logical, m_logical, sizeof(m_logical));
+    }
+    uint32_t level_sum = 0;
+    m_strips.for_each([&](auto &slot, int k)
+                      { level_sum += slot.correct_frame(m_logical, solid, m_solid_color); });
+    uint32_t scale_q16 = m_current_limiter.fit_frame(level_sum, MAX_LEVEL, Layout::PHYSICAL_PIXELS);
+    m_strips.for_each([&](auto &slot, int k)
+                      { slot.quantize_frame(scale_q16, logical_unchanged); });
+  }
+
+  void turn_off_all_leds()
+  {
+    memset(m_target, 0, sizeof(m_logical));
+  }
+
+  void update_direct_rgb(ControlInput input)
+  {
+    render_solid(widen(input.color));
+  }
+
+  // Pulsing noise ((cos(a) * sin(b)) + 1) / 2, in Q15. For a pixel at x
+  // along the strip, a = 2x + t and b = x - t/2.
+  inline int32_t get_pulsing_noise(FixedTrig::Phase a, FixedTrig::Phase b)
+  {
+    return (FixedTrig::mul_q15(FixedTrig::cos_q15(a), FixedTrig::sin_q15(b)) + FixedTrig::Q15_ONE) >> 1;
+  }
+
+  void update_direct_rgb_pulsing(ControlInput input)
+  {
+    // Same as direct_rgb, but apply a time-varying pulsing effect to make the sword look more
+    // organic. Scale is 1 - 0.75 * noise, in Q15 with 1 << 15 as full brightness.
+    const FixedTrig::Phase step_x = FixedTrig::phase_from_radians(1. / 20.);
+    const FixedTrig::Phase a_0 = FixedTrig::phase_from_radians(input.t);
+    const FixedTrig::Phase b_0 = FixedTrig::phase_from_radians(-0.5 * input.t);
+    const Color16 c = widen(input.color);
+
+    render([&](int i)
+           {
+             uint32_t scale = (1 << 15) - ((3 * get_pulsing_noise(a_0 + 2 * i * step_x, b_0 + i * step_x)) >> 2);
+             return Color16{(uint16_t)((scale * c.r) >> 15), (uint16_t)((scale * c.g) >> 15), (uint16_t)((scale * c.b) >> 15)};
+           });
+  }
+
   inline Color get_rainbow(uint32_t hue, uint8_t value)
   {
-    uint32_t c = m_pixels_1->ColorHSV(hue, 255, value);
-    c = m_pixels_1->gamma32(c);
+    uint32_t c = Adafruit_NeoPixel::ColorHSV(hue, 255, value);
+    c = Adafruit_NeoPixel::gamma32(c);
     return {(uint8_t)(c >> 16), (uint8_t)(c >> 8), (uint8_t)c};
   }
 
+  // R = value * (cos(x) + 1) / 2, G = value * (cos(2x) + 1) / 2,
+  // B = value * (cos(3x) + 2) / 3.
+  inline Color16 get_flowing_color(uint8_t value, FixedTrig::Phase x)
+  {
+    int32_t r = value * (FixedTrig::cos_q15(x) + 32768);
+    int32_t g = value * (FixedTrig::cos_q15(2 * x) + 32768);
+    int32_t b = value * (FixedTrig::cos_q15(3 * x) + 65536);
+    return {(uint16_t)(r >> 8), (uint16_t)(g >> 8), (uint16_t)(b / 384)};
+  }
+
   void update_party_mode_flowing(ControlInput input)
   {
     // Use total RGB brightness but not colors.
@@ -150,31 +902,11 @@ public:
     // uint8_t g = (uint8_t)(c >> 8);
     // uint8_t b = (uint8_t)c;
     // Blue is always slightly on; R and G cycle out of sync.
-    if (m_pixels_1)
-    {
-      for (int i = 0; i <= get_num_leds_to_update(*m_pixels_1); i++)
-      {
-        float x = i / 100. - 0.5 * input.t;
-        uint8_t r = value * (cos(x * 1.) + 1.) / 2.;
-        uint8_t g = value * (cos(x * 2) + 1.) / 2.;
-        uint8_t b = value * (cos(x * 3) + 2.) / 3.;
-        setPixels1Color(i, r, g, b);
-      }
-      m_pixels_1->show();
-    }
-
-    if (m_pixels_2)
-    {
-      for (int i = 0; i <= get_num_leds_to_update(*m_pixels_2); i++)
-      {
-        float x = i / 100. - 0.5 * input.t;
-        uint8_t r = value * (cos(x * 1.) + 1.) / 2.;
-        uint8_t g = value * (cos(x * 2) + 1.) / 2.;
-        uint8_t b = value * (cos(x * 3) + 2.) / 3.;
-        setPixels2Color(i, r, g, b);
-      }
-      m_pixels_2->show();
-    }
+    // x = i / 100 - t / 2.
+    const FixedTrig::Phase step_x = FixedTrig::phase_from_radians(1. / 100.);
+    const FixedTrig::Phase x_0 = FixedTrig::phase_from_radians(-0.5 * input.t);
+    render([&](int i)
+           { return get_flowing_color(value, x_0 + i * step_x); });
   }
 
   void update_party_mode_rolling(ControlInput input)
@@ -188,62 +920,146 @@ public:
     // uint8_t g = (uint8_t)(c >> 8);
     // uint8_t b = (uint8_t)c;
     //  Blue is always slightly on; R and G cycle out of sync.
-    uint8_t r = value * (cos(input.t) + 1.) / 2.;
-    uint8_t g = value * (cos(input.t * 2) + 1.) / 2.;
-    uint8_t b = value * (cos(input.t * 3) + 2.) / 3.;
+    render_solid(get_flowing_color(value, FixedTrig::phase_from_radians(input.t)));
+  }
+
+  // Effect program run by ControlMode::Program; nothing until one loads.
+  EffectProgram m_program;
+
+  // Returns false (keeping the current program) if it doesn't validate.
+  bool load_program(const uint8_t *bytes, int length)
+  {
+    return m_program.load(bytes, length);
+  }
 
-    if (m_pixels_1)
+  void update_program(ControlInput input)
+  {
+    if (!m_program.loaded())
     {
-      for (int i = 0; i <= get_num_leds_to_update(*m_pixels_1); i++)
-      {
-        setPixels1Color(i, r, g, b);
-      }
-      m_pixels_1->show();
+      turn_off_all_leds();
+      return;
+    }
+    const EffectProgram::Frame frame = EffectProgram::make_frame(input.t, input.color.r, input.color.g, input.color.b);
+    render([&](int i)
+           {
+             Color c;
+             m_program.eval(frame, i, &c.r, &c.g, &c.b);
+             return widen(c);
+           });
+  }
+
+  // Stream played by ControlMode::Keyframes; owned by PropBLEManager.
+  KeyframeStream *m_keyframes = nullptr;
+
+  void register_keyframes(KeyframeStream *keyframes)
+  {
+    m_keyframes = keyframes;
+  }
+
+  void update_keyframes(ControlInput input)
+  {
+    Keyframe keyframe;
+    if (!m_keyframes || !m_keyframes->sample(millis(), &keyframe) || !(keyframe.flags & KEYFRAME_ON))
+    {
+      turn_off_all_leds();
+      return;
     }
+    ControlMode mode = (ControlMode)keyframe.mode;
+    render_mode({input.t, true, {keyframe.r, keyframe.g, keyframe.b}, mode == ControlMode::Keyframes ? ControlMode::DirectRGB : mode});
+  }
 
-    if (m_pixels_2)
+  static ProfileStage effect_stage(ControlMode mode)
+  {
+    if (mode < ControlMode::DirectRGB || mode > ControlMode::Keyframes)
     {
-      for (int i = 0; i <= get_num_leds_to_update(*m_pixels_2); i++)
-      {
-        setPixels2Color(i, r, g, b);
-      }
-      m_pixels_2->show();
+      return STAGE_EFFECT_OFF;
     }
+    return (ProfileStage)(STAGE_EFFECT_DIRECT_RGB + mode);
   }
 
-  void update(ControlInput input)
+  // Dispatch to mode-specific controller.
+  void render_mode(ControlInput input)
   {
-    if (input.control_mode != m_last_control_mode){
-      m_last_control_mode = input.control_mode;
-      m_last_mode_change_ms = millis();
+    switch (input.control_mode)
+    {
+    case ControlMode::DirectRGB:
+      update_direct_rgb(input);
+      break;
+    case ControlMode::DirectRGBPulsing:
+      update_direct_rgb_pulsing(input);
+      break;
+    case ControlMode::PartyModeFlowing:
+      update_party_mode_flowing(input);
+      break;
+    case ControlMode::PartyModeRolling:
+      update_party_mode_rolling(input);
+      break;
+    case ControlMode::Program:
+      update_program(input);
+      break;
+    case ControlMode::Keyframes:
+      update_keyframes(input);
+      break;
+    default:
+      turn_off_all_leds();
+      break;
     }
+  }
 
+  // Renders an input, switched off or not, into a logical framebuffer.
+  void render_into(ControlInput input, Color16 *logical)
+  {
+    m_target = logical;
     if (!input.on_off)
     {
-      m_last_mode_change_ms = millis();
+      StageTimer timer(STAGE_EFFECT_OFF);
       turn_off_all_leds();
     }
     else
     {
-      // Dispatch to mode-specific controller.
-      switch (input.control_mode)
-      {
-      case ControlMode::DirectRGB:
-        update_direct_rgb(input);
-        break;
-      case ControlMode::DirectRGBPulsing:
-        update_direct_rgb_pulsing(input);
-        break;
-      case ControlMode::PartyModeFlowing:
-        update_party_mode_flowing(input);
-        break;
-      case ControlMode::PartyModeRolling:
-        update_party_mode_rolling(input);
-        break;
-      default:
-        turn_off_all_leds();
-        break;
-      }
+      StageTimer timer(effect_stage(input.control_mode));
+      render_mode(input);
+    }
+    m_target = m_logical;
+  }
+
+  // Set once switched off, faded out and the blank frame shown: update()
+  // then does nothing until switched back on.
+  bool m_idle = false;
+
+  bool idle() const
+  {
+    return m_idle;
+  }
+
+  void update(ControlInput input)
+  {
+    if (!m_ready || (m_idle && !input.on_off))
+    {
+      return;
+    }
+    m_governor.frame_started();
+
+    start_transition_if_changed(input);
+    m_solid = false;
+    render_into(input, m_logical);
+    bool transitioning = in_transition();
+    if (transitioning)
+    {
+      m_solid = false;
+      ControlInput outgoing = m_outgoing;
+      outgoing.t = input.t;
+      render_into(outgoing, m_outgoing_frame);
+      int32_t f_q15 = ((uint64_t)(millis() - m_transition_start_ms) << 15) / m_transition_ms;
+      blend_transition(m_transition_type, m_outgoing_frame, m_logical, Layout::LOGICAL_PIXELS, f_q15);
+    }
+
+    {
+      StageTimer timer(STAGE_PIXEL_MAP);
+      apply_pixel_maps();
     }
+    show_dirty_strips();
+    m_governor.frame_finished();
+    m_idle = !input.on_off && !transitioning;
   }
-};
\ No newline at end of file
+};
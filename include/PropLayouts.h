@@ -0,0 +1,22 @@
+#pragma once
+
+#include "SwordLayout.h"
+
+// Each prop's strips, in one place: main-<prop>.cpp builds its strips and
+// driver from these, and the host tools that render a prop use the same
+// ones.
+
+// Venat: the sword blade, whose strip rolls back over the tip, then the
+// gems on their own strip.
+const int VENAT_TIP_LED_START = 60;   // Number of LEDs along the strand where the rolled-back segments starts.
+const int VENAT_TIP_LED_END = 150;    // Index of final LED in the strip.
+const int VENAT_TIP_HALF_N_LEDS = 45; // Number of LEDs on one side of the rolled-back segment.
+const int VENAT_NUM_PIXELS_GEMS = 4;
+typedef SwordLayout<VENAT_TIP_LED_START, VENAT_TIP_LED_END, VENAT_TIP_HALF_N_LEDS,
+                    StripSpec<VENAT_NUM_PIXELS_GEMS, NEO_GRB>>
+    VenatLayout;
+
+typedef PropLayout<StripSpec<7, NEO_GRBW>> HermesLayout;
+typedef PropLayout<StripSpec<1, NEO_RGB>, StripSpec<1, NEO_RGB>> HythLayout;
+typedef PropLayout<StripSpec<1, NEO_GRBW>, StripSpec<1, NEO_GRBW>> HythArrowLayout;
+typedef PropLayout<StripSpec<3, NEO_GRB>, StripSpec<3, NEO_GRB>> EmetLayout;
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Layouts with more strips than this don't fit the profiler's show stages.
+const int MAX_PROFILED_STRIPS = 8;
+
+// Stages timed by StageProfiler, in the order of the diagnostics
+// characteristic's records. The effect stages follow ControlMode's order.
+typedef enum ProfileStage
+{
+  STAGE_BLE_UPDATE = 0,
+  STAGE_BATTERY_READ,
+  STAGE_EFFECT_DIRECT_RGB,
+  STAGE_EFFECT_DIRECT_RGB_PULSING,
+  STAGE_EFFECT_PARTY_MODE_FLOWING,
+  STAGE_EFFECT_PARTY_MODE_ROLLING,
+  STAGE_EFFECT_PROGRAM,
+  STAGE_EFFECT_KEYFRAMES,
+  // LEDs switched off, or an unknown mode.
+  STAGE_EFFECT_OFF,
+  STAGE_PIXEL_MAP,
+  STAGE_STATUS_LED,
+  // One per strip, STAGE_SHOW_1 + k for the layout's strip k. Only counted
+  // when the strip was actually pushed.
+  STAGE_SHOW_1,
+  NUM_STAGES = STAGE_SHOW_1 + MAX_PROFILED_STRIPS
+} ProfileStage;
+
+// Where a prop spends its loop time, stage by stage, so it can be tuned in
+// the field. Instrumented code times each stage with a StageTimer; per
+// stage, the profiler keeps the count, min / avg / max and a histogram of
+// durations. PropBLEManager::publish_profile puts it on the diagnostics
+// characteristic, and the props' mains dump it on serial.
+//
+// Times come from micros(), so they have 1 us resolution. On host builds
+// that's the simulated clock, where only show() and delay() take time.
+class StageProfiler
+{
+public:
+  // Bucket k counts durations under 4^(k+1) us (<4, <16, ... <16384); the
+  // last one counts everything longer. Counts saturate.
+  static const int NUM_BUCKETS = 8;
+  // Packed stats per stage, little-endian: count, min, avg, max as uint32,
+  // then the buckets as uint16.
+  static const int RECORD_SIZE = 16 + 2 * NUM_BUCKETS;
+  // Packed, the show stages stop after the first PACKED_STRIPS strips, to
+  // keep within a characteristic's 512 bytes; no prop drives more strips
+  // than the nRF52840 has PWM peripherals. dump() prints every stage.
+  static const int PACKED_STRIPS = 4;
+  static const int PACKED_STAGES = STAGE_SHOW_1 + PACKED_STRIPS;
+  static const int PACKED_SIZE = PACKED_STAGES * RECORD_SIZE;
+
+  typedef struct StageStats
+  {
+    uint32_t count;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint64_t total_us;
+    uint16_t buckets[NUM_BUCKETS];
+  } StageStats;
+
+  static StageProfiler &instance()
+  {
+    static StageProfiler profiler;
+    return profiler;
+  }
+
+  StageProfiler()
+  {
+    reset();
+  }
+
+  void reset()
+  {
+    memset(m_stats, 0, sizeof(m_stats));
+  }
+
+  void record(ProfileStage stage, uint32_t us)
+  {
+    StageStats &s = m_stats[stage];
+    s.min_us = s.count == 0 ? us : min(s.min_us, us);
+    s.max_us = max(s.max_us, us);
+    s.total_us += us;
+    s.count++;
+    uint16_t &bucket = s.buckets[bucket_index(us)];
+    if (bucket < 0xFFFF)
+    {
+      bucket++;
+    }
+  }
+
+  const StageStats &stats(ProfileStage stage) const
+  {
+    return m_stats[stage];
+  }
+
+  static int bucket_index(uint32_t us)
+  {
+    int k = 0;
+    while (k < NUM_BUCKETS - 1 && us >= (4ul << (2 * k)))
+    {
+      k++;
+    }
+    return k;
+  }
+
+  static const char *stage_name(int stage)
+  {
+    static const char *const NAMES[NUM_STAGES] = {
+        "ble_update", "battery_read", "direct_rgb", "direct_rgb_pulsing", "party_flowing", "party_rolling",
+        "program", "keyframes", "leds_off", "pixel_map", "status_led", "show_1", "show_2", "show_3", "show_4",
+        "show_5", "show_6", "show_7", "show_8"};
+    return NAMES[stage];
+  }
+
+  // Writes PACKED_SIZE bytes.
+  void pack(uint8_t *out) const
+  {
+    for (int i = 0; i < PACKED_STAGES; i++)
+    {
+      const StageStats &s = m_stats[i];
+      uint32_t fields[4] = {s.count, s.min_us, average_us(s), s.max_us};
+      uint8_t *p = out + i * RECORD_SIZE;
+      for (int k = 0; k < 16; k++)
+      {
+        p[k] = (fields[k / 4] >> (8 * (k % 4))) & 0xFF;
+      }
+      for (int k = 0; k < NUM_BUCKETS; k++)
+      {
+        p[16 + 2 * k] = s.buckets[k] & 0xFF;
+        p[17 + 2 * k] = s.buckets[k] >> 8;
+      }
+    }
+  }
+
+  // Prints a table of every stage that has run, e.g. to Serial.
+  template <typename Output>
+  void dump(Output &out) const
+  {
+    char line[128];
+    snprintf(line, sizeof(line), "%-18s %8s %6s %6s %6s |%6s%6s%6s%6s%6s%6s%6s%6s\n", "stage (us)", "count", "min",
+             "avg", "max", "<4", "<16", "<64", "<256", "<1k", "<4k", "<16k", "more");
+    out.print(line);
+    for (int i = 0; i < NUM_STAGES; i++)
+    {
+      const StageStats &s = m_stats[i];
+      if (s.count == 0)
+      {
+        continue;
+      }
+      int n = snprintf(line, sizeof(line), "%-18s %8lu %6lu %6lu %6lu |", stage_name(i), (unsigned long)s.count,
+                       (unsigned long)s.min_us, (unsigned long)average_us(s), (unsigned long)s.max_us);
+      for (int k = 0; k < NUM_BUCKETS; k++)
+      {
+        n += snprintf(line + n, sizeof(line) - n, "%6u", (unsigned)s.buckets[k]);
+      }
+      snprintf(line + n, sizeof(line) - n, "\n");
+      out.print(line);
+    }
+  }
+
+private:
+  static uint32_t average_us(const StageStats &s)
+  {
+    return s.count ? (uint32_t)(s.total_us / s.count) : 0;
+  }
+
+  StageStats m_stats[NUM_STAGES];
+};
+
+// Times the enclosing scope as one run of a stage.
+class StageTimer
+{
+public:
+  StageTimer(ProfileStage stage) : m_stage(stage), m_start_us(micros())
+  {
+  }
+
+  ~StageTimer()
+  {
+    StageProfiler::instance().record(m_stage, micros() - m_start_us);
+  }
+
+private:
+  ProfileStage m_stage;
+  unsigned long m_start_us;
+};
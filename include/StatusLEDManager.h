@@ -1,33 +1,123 @@
 #pragma once
 
+#include "StageProfiler.h"
+
+// Plays a repeating pattern on the status LED without blocking: update()
+// switches the LED whenever the current step is over, and returns. Run it
+// from a scheduler task at least every STEP_MS; every pattern's times are
+// multiples of that.
+//
+// A pattern is a list of step times that alternate on, off, on, ... and
+// then repeat. Setting the pattern that's already playing carries on with
+// it, so a task can set the pattern for the current state every time.
 class StatusLEDManager
 {
 public:
-    unsigned long flip_time_ms = 0;
+    static const unsigned long STEP_MS = 50;
+    static const int MAX_STEPS = 20;
+    static const int MAX_CODE = (MAX_STEPS - 2) / 2;
 
-    StatusLEDManager(int led_pin) : m_led_pin(led_pin)
+    // active_low: the LED lights with the pin driven low.
+    StatusLEDManager(int led_pin, bool active_low = false) : m_led_pin(led_pin), m_active_low(active_low)
     {
     }
 
     bool setup()
     {
         pinMode(m_led_pin, OUTPUT);
+        digitalWrite(m_led_pin, m_active_low);
         return true;
     }
 
+    // steps_ms: on and off times in turn; num_steps must be even. No steps
+    // leaves the LED off.
+    void set_pattern(const uint16_t steps_ms[], int num_steps)
+    {
+        num_steps = min(num_steps, (int)MAX_STEPS) & ~1;
+        uint16_t steps[MAX_STEPS];
+        unsigned long cycle_ms = 0;
+        for (int i = 0; i < num_steps; i++)
+        {
+            steps[i] = max(steps_ms[i], (uint16_t)1);
+            cycle_ms += steps[i];
+        }
+        if (num_steps == m_num_steps && !memcmp(steps, m_steps_ms, num_steps * sizeof(uint16_t)))
+        {
+            return;
+        }
+        memcpy(m_steps_ms, steps, num_steps * sizeof(uint16_t));
+        m_num_steps = num_steps;
+        m_cycle_ms = cycle_ms;
+        m_step = 0;
+        m_step_start_ms = millis();
+        m_restarted = true;
+    }
+
+    // On and off for period_ms each.
+    void blink(uint16_t period_ms)
+    {
+        const uint16_t steps[] = {period_ms, period_ms};
+        set_pattern(steps, 2);
+    }
+
+    // n short flashes, then a pause: tells failures (and levels) apart.
+    void blink_code(int n)
+    {
+        n = constrain(n, 1, (int)MAX_CODE);
+        uint16_t steps[MAX_STEPS];
+        for (int i = 0; i < n; i++)
+        {
+            steps[2 * i] = 150;
+            steps[2 * i + 1] = 250;
+        }
+        steps[2 * n - 1] = 1200;
+        set_pattern(steps, 2 * n);
+    }
+
+    // Two short pulses a second: running, nothing to report.
+    void heartbeat()
+    {
+        const uint16_t steps[] = {100, 150, 100, 650};
+        set_pattern(steps, 4);
+    }
+
+    void off()
+    {
+        set_pattern(nullptr, 0);
+    }
+
     void update()
     {
-        unsigned long t = millis();
-        if (t - m_last_flip_time_ms > flip_time_ms)
+        StageTimer timer(STAGE_STATUS_LED);
+        bool on = false;
+        if (m_num_steps > 0)
+        {
+            unsigned long t = millis();
+            // Skip whole cycles missed while nothing called update().
+            m_step_start_ms += (t - m_step_start_ms) / m_cycle_ms * m_cycle_ms;
+            while (t - m_step_start_ms >= m_steps_ms[m_step])
+            {
+                m_step_start_ms += m_steps_ms[m_step];
+                m_step = (m_step + 1) % m_num_steps;
+            }
+            on = m_step % 2 == 0;
+        }
+        if (on != m_led_state || m_restarted)
         {
-            m_last_flip_time_ms = t;
-            m_led_state = !m_led_state;
-            digitalWrite(LED_BUILTIN, m_led_state);
+            m_led_state = on;
+            m_restarted = false;
+            digitalWrite(m_led_pin, m_led_state != m_active_low);
         }
     }
 
 private:
     int m_led_pin;
-    int m_led_state = 0;
-    unsigned long m_last_flip_time_ms = 0;
+    bool m_active_low;
+    bool m_led_state = false;
+    bool m_restarted = true;
+    uint16_t m_steps_ms[MAX_STEPS];
+    int m_num_steps = 0;
+    unsigned long m_cycle_ms = 0;
+    int m_step = 0;
+    unsigned long m_step_start_ms = 0;
 };
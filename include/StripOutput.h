@@ -0,0 +1,196 @@
+#pragma once
+
+#include <Adafruit_NeoPixel.h>
+
+#if defined(NRF52840_XXAA)
+#include <nrf.h>
+#endif
+
+// Where PropLEDDriver sends a strip's frames. The driver writes each frame
+// into the strip's own pixel buffer (the back buffer) and calls show(). A
+// backend either clocks the buffer out there and then, or copies it to a
+// front buffer that goes out in the background while the next frame is
+// rendered, and while other strips send theirs.
+class StripOutput
+{
+public:
+  virtual ~StripOutput()
+  {
+  }
+
+  // Sends the strip's pixel buffer, first waiting for the previous frame
+  // to finish. The buffer may be written again as soon as this returns.
+  virtual void show() = 0;
+
+  // True while a frame is still going out (including its latch).
+  virtual bool busy() = 0;
+
+  // Returns once nothing is going out.
+  virtual void wait() = 0;
+};
+
+// Adafruit_NeoPixel's own show(), which returns once the frame is out.
+class BlockingStripOutput : public StripOutput
+{
+public:
+  Adafruit_NeoPixel *m_strip = nullptr;
+
+  void show() override
+  {
+    m_strip->show();
+  }
+
+  bool busy() override
+  {
+    return false;
+  }
+
+  void wait() override
+  {
+  }
+};
+
+// Double-buffered output for a Strip (a StripSpec): show() copies the frame
+// into a front buffer and starts sending it, then returns.
+//
+// On the nRF52840 the front buffer is the PWM duty-cycle sequence for the
+// frame, one word per bit, clocked out by one of the chip's PWM
+// peripherals with EasyDMA (the same waveform Adafruit_NeoPixel generates,
+// which waits for it instead). Each strip needs its own peripheral, so
+// strips go out concurrently.
+//
+// On host builds the front buffer is a plain copy, and the strip is busy
+// for the fake's sim_transmit_us() of simulated time; waiting moves the
+// clock on to when the transmission would have finished.
+template <typename Strip>
+class AsyncStripOutput : public StripOutput
+{
+public:
+  // pwm: which of the nRF52840's PWM peripherals (0-3) to use. Unused on
+  // host builds.
+  AsyncStripOutput(Adafruit_NeoPixel &strip, int pwm) : m_strip(strip), m_pwm_index(pwm)
+  {
+  }
+
+  // Call after the strip's begin(). Returns false if the strip doesn't
+  // match Strip.
+  bool begin()
+  {
+    if (m_strip.numPixels() != Strip::NUM_PIXELS || m_pwm_index < 0 || m_pwm_index > 3)
+    {
+      return false;
+    }
+#if defined(NRF52840_XXAA)
+    NRF_PWM_Type *const PWMS[] = {NRF_PWM0, NRF_PWM1, NRF_PWM2, NRF_PWM3};
+    m_pwm = PWMS[m_pwm_index];
+    for (int i = 0; i < LATCH_WORDS; i++)
+    {
+      m_pattern[Strip::NUM_BYTES * 8 + i] = LOW_WORD;
+    }
+    m_pwm->MODE = PWM_MODE_UPDOWN_Up << PWM_MODE_UPDOWN_Pos;
+    m_pwm->PRESCALER = PWM_PRESCALER_PRESCALER_DIV_1 << PWM_PRESCALER_PRESCALER_Pos;
+    m_pwm->COUNTERTOP = PERIOD_TICKS << PWM_COUNTERTOP_COUNTERTOP_Pos;
+    m_pwm->LOOP = PWM_LOOP_CNT_Disabled << PWM_LOOP_CNT_Pos;
+    m_pwm->DECODER = (PWM_DECODER_LOAD_Common << PWM_DECODER_LOAD_Pos) |
+                     (PWM_DECODER_MODE_RefreshCount << PWM_DECODER_MODE_Pos);
+    m_pwm->SEQ[0].PTR = (uint32_t)m_pattern << PWM_SEQ_PTR_PTR_Pos;
+    m_pwm->SEQ[0].CNT = PATTERN_WORDS << PWM_SEQ_CNT_CNT_Pos;
+    m_pwm->SEQ[0].REFRESH = 0;
+    m_pwm->SEQ[0].ENDDELAY = 0;
+#if defined(ARDUINO_ARCH_MBED)
+    m_pwm->PSEL.OUT[0] = digitalPinToPinName(m_strip.getPin());
+#else
+    m_pwm->PSEL.OUT[0] = g_ADigitalPinMap[m_strip.getPin()];
+#endif
+    m_pwm->ENABLE = 1;
+#endif
+    m_begun = true;
+    return true;
+  }
+
+  void show() override
+  {
+    if (!m_begun)
+    {
+      return;
+    }
+    wait();
+    const uint8_t *pixels = m_strip.getPixels();
+#if defined(NRF52840_XXAA)
+    uint16_t *word = m_pattern;
+    for (int i = 0; i < Strip::NUM_BYTES; i++)
+    {
+      for (uint8_t mask = 0x80; mask; mask >>= 1)
+      {
+        *word++ = (pixels[i] & mask) ? ONE_WORD : ZERO_WORD;
+      }
+    }
+    m_pwm->EVENTS_SEQEND[0] = 0;
+    m_pwm->TASKS_SEQSTART[0] = 1;
+    m_sending = true;
+#else
+    memcpy(m_front, pixels, Strip::NUM_BYTES);
+    m_strip.sim_record_show();
+    m_busy_until_us = NativeSim::time_us() + m_strip.sim_transmit_us();
+#endif
+  }
+
+  bool busy() override
+  {
+#if defined(NRF52840_XXAA)
+    if (m_sending && m_pwm->EVENTS_SEQEND[0])
+    {
+      m_sending = false;
+    }
+    return m_sending;
+#else
+    return NativeSim::time_us() < m_busy_until_us;
+#endif
+  }
+
+  void wait() override
+  {
+#if defined(NRF52840_XXAA)
+    while (busy())
+    {
+      yield();
+    }
+#else
+    if (busy())
+    {
+      NativeSim::set_time_us(m_busy_until_us);
+    }
+#endif
+  }
+
+#if !defined(NRF52840_XXAA)
+  // The frame going out, or last sent.
+  const uint8_t *front() const
+  {
+    return m_front;
+  }
+#endif
+
+private:
+  Adafruit_NeoPixel &m_strip;
+  int m_pwm_index;
+  bool m_begun = false;
+#if defined(NRF52840_XXAA)
+  // 16 MHz / 20 ticks = 800 kHz bits. The top bit inverts the polarity, so
+  // each bit starts high for its duty cycle: 0.8 us for a 1, 0.4 us for a 0.
+  static const uint16_t PERIOD_TICKS = 20;
+  static const uint16_t ONE_WORD = 13 | 0x8000;
+  static const uint16_t ZERO_WORD = 6 | 0x8000;
+  // Held low for the strip's 300 us latch after the frame.
+  static const uint16_t LOW_WORD = 0x8000;
+  static const int LATCH_WORDS = 240;
+  static const int PATTERN_WORDS = Strip::NUM_BYTES * 8 + LATCH_WORDS;
+  static_assert(PATTERN_WORDS <= 0x7FFF, "Strip too long for one PWM sequence");
+  NRF_PWM_Type *m_pwm = nullptr;
+  bool m_sending = false;
+  uint16_t m_pattern[PATTERN_WORDS];
+#else
+  uint8_t m_front[Strip::NUM_BYTES];
+  uint64_t m_busy_until_us = 0;
+#endif
+};
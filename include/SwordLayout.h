@@ -0,0 +1,36 @@
+#pragma once
+
+#include "PropLEDDriver.h"
+
+// A sword blade whose strip runs up the blade, then rolls back over the
+// tip: the rolled-back segment is commanded symmetrically from the pixels
+// below it. Effects only render the blade up to halfway up the tip.
+//   TIP_LED_START: Number of LEDs along the strand where the rolled-back segment starts.
+//   TIP_LED_END: Index of final LED in the strip; the blade strip has this many pixels.
+//   TIP_HALF_N_LEDS: Number of LEDs on one side of the rolled-back segment.
+template <uint16_t TIP_LED_START, uint16_t TIP_LED_END, uint16_t TIP_HALF_N_LEDS>
+struct SwordBlade : StripSpec<TIP_LED_END, NEO_GRB>
+{
+  enum
+  {
+    LOGICAL_END = TIP_LED_START + TIP_HALF_N_LEDS + 1,
+    NUM_SEGMENTS = 3
+  };
+
+  static const PixelSegment *segments()
+  {
+    static const PixelSegment segments[] = {
+        // Blade, with the blue slightly cut for white balance.
+        {0, TIP_LED_START, 0, false, 256, 256, 230},
+        // Tip, up and then back down, commanded symmetrically. The tip strip
+        // needs its own color correction: slightly cut the red.
+        {TIP_LED_START, TIP_HALF_N_LEDS + 1, TIP_LED_START, false, 230, 256, 256},
+        {TIP_LED_START + 1, TIP_HALF_N_LEDS, TIP_LED_END - 1, true, 230, 256, 256},
+    };
+    return segments;
+  }
+};
+
+// A sword blade as the first strip, then any others.
+template <uint16_t TIP_LED_START, uint16_t TIP_LED_END, uint16_t TIP_HALF_N_LEDS, typename... STRIPS>
+using SwordLayout = PropLayout<SwordBlade<TIP_LED_START, TIP_LED_END, TIP_HALF_N_LEDS>, STRIPS...>;
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <limits.h>
+
+// Cooperative multi-rate scheduler for the main loop. Each task runs at
+// (roughly) its own period; loop() just calls update(), which runs whatever
+// is due, in the order the tasks were added.
+//
+// Tasks are scheduled on a fixed grid (next_due_us += period_us), so they
+// don't drift when they run a little late. A task that falls a whole period
+// or more behind counts an overrun, and the missed runs are dropped instead
+// of being run back to back.
+typedef void (*TaskFunction)();
+
+typedef struct Task
+{
+    const char *name;
+    TaskFunction function;
+    unsigned long period_us;
+    unsigned long next_due_us;
+    // Stats since setup.
+    unsigned long runs;
+    unsigned long overruns;
+    unsigned long max_late_us;
+    unsigned long max_run_us;
+} Task;
+
+class TaskScheduler
+{
+public:
+    static const int MAX_TASKS = 8;
+
+    // Returns the task's index, or -1 if the scheduler is full.
+    int add_task(const char *name, TaskFunction function, unsigned long period_us)
+    {
+        if (m_num_tasks >= MAX_TASKS)
+        {
+            return -1;
+        }
+        m_tasks[m_num_tasks] = {name, function, period_us, micros(), 0, 0, 0, 0};
+        return m_num_tasks++;
+    }
+
+    void update()
+    {
+        for (int i = 0; i < m_num_tasks; i++)
+        {
+            Task &task = m_tasks[i];
+            unsigned long t = micros();
+            unsigned long late_us = t - task.next_due_us;
+            // Not due yet (wraparound-safe).
+            if ((long)late_us < 0)
+            {
+                continue;
+            }
+
+            // Before running it, so a task can change its own period.
+            if (late_us >= task.period_us)
+            {
+                task.overruns++;
+                task.next_due_us = t + task.period_us;
+            }
+            else
+            {
+                task.next_due_us += task.period_us;
+            }
+
+            task.function();
+
+            unsigned long run_us = micros() - t;
+            task.runs++;
+            task.max_late_us = max(task.max_late_us, late_us);
+            task.max_run_us = max(task.max_run_us, run_us);
+        }
+    }
+
+    // Changes a task's period, keeping its last run as the reference: a
+    // shorter period brings its next run forward.
+    void set_period(int task, unsigned long period_us)
+    {
+        if (task < 0 || task >= m_num_tasks || m_tasks[task].period_us == period_us)
+        {
+            return;
+        }
+        Task &t = m_tasks[task];
+        t.next_due_us = t.next_due_us - t.period_us + period_us;
+        t.period_us = period_us;
+    }
+
+    // Time until the next task is due; 0 if one already is.
+    unsigned long us_until_due() const
+    {
+        unsigned long now = micros();
+        unsigned long until_us = ULONG_MAX;
+        for (int i = 0; i < m_num_tasks; i++)
+        {
+            long until = (long)(m_tasks[i].next_due_us - now);
+            until_us = min(until_us, (unsigned long)max(until, 0l));
+        }
+        return until_us;
+    }
+
+    // Sleeps until the next task is due, rounded up to the millisecond, so
+    // it may run up to 1 ms late. On the nRF52 core delay() hands the CPU to
+    // the RTOS idle thread, which sleeps it until the next timer or radio
+    // interrupt; the BLE stack keeps running, and its events are handled at
+    // the next BLE.poll().
+    void sleep_until_due()
+    {
+        unsigned long until_us = us_until_due();
+        if (until_us == 0 || until_us == ULONG_MAX)
+        {
+            return;
+        }
+        unsigned long t = micros();
+        delay((until_us + 999) / 1000);
+        m_slept_us += micros() - t;
+    }
+
+    // Time spent in sleep_until_due() since setup.
+    uint64_t slept_us() const
+    {
+        return m_slept_us;
+    }
+
+    int num_tasks() const
+    {
+        return m_num_tasks;
+    }
+
+    const Task &task(int i) const
+    {
+        return m_tasks[i];
+    }
+
+    // Clears the per-task stats (not the schedule).
+    void reset_stats()
+    {
+        for (int i = 0; i < m_num_tasks; i++)
+        {
+            m_tasks[i].runs = 0;
+            m_tasks[i].overruns = 0;
+            m_tasks[i].max_late_us = 0;
+            m_tasks[i].max_run_us = 0;
+        }
+    }
+
+    // Prints a table of each task's stats, e.g. to Serial.
+    template <typename Output>
+    void dump(Output &out) const
+    {
+        char line[96];
+        snprintf(line, sizeof(line), "%-12s %10s %10s %9s %11s %10s\n", "task", "period_us", "runs", "overruns",
+                 "max_late_us", "max_run_us");
+        out.print(line);
+        for (int i = 0; i < m_num_tasks; i++)
+        {
+            const Task &t = m_tasks[i];
+            snprintf(line, sizeof(line), "%-12s %10lu %10lu %9lu %11lu %10lu\n", t.name, t.period_us, t.runs, t.overruns,
+                     t.max_late_us, t.max_run_us);
+            out.print(line);
+        }
+    }
+
+private:
+    Task m_tasks[MAX_TASKS];
+    int m_num_tasks = 0;
+    uint64_t m_slept_us = 0;
+};
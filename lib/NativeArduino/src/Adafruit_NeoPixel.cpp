@@ -0,0 +1,321 @@
+#include "Adafruit_NeoPixel.h"
+
+namespace
+{
+  const int MAX_INSTANCES = 32;
+  Adafruit_NeoPixel *g_instances[MAX_INSTANCES];
+  int g_num_instances = 0;
+}
+
+Adafruit_NeoPixel::Adafruit_NeoPixel(uint16_t n, int16_t pin, neoPixelType type)
+{
+  updateType(type);
+  updateLength(n);
+  setPin(pin);
+  register_instance();
+}
+
+Adafruit_NeoPixel::Adafruit_NeoPixel()
+{
+  register_instance();
+}
+
+Adafruit_NeoPixel::~Adafruit_NeoPixel()
+{
+  unregister_instance();
+  free(m_pixels);
+}
+
+void Adafruit_NeoPixel::register_instance()
+{
+  if (g_num_instances < MAX_INSTANCES)
+  {
+    g_instances[g_num_instances++] = this;
+  }
+}
+
+void Adafruit_NeoPixel::unregister_instance()
+{
+  for (int i = 0; i < g_num_instances; i++)
+  {
+    if (g_instances[i] == this)
+    {
+      g_instances[i] = g_instances[--g_num_instances];
+      return;
+    }
+  }
+}
+
+int Adafruit_NeoPixel::sim_num_instances()
+{
+  return g_num_instances;
+}
+
+Adafruit_NeoPixel *Adafruit_NeoPixel::sim_instance(int i)
+{
+  return (i >= 0 && i < g_num_instances) ? g_instances[i] : nullptr;
+}
+
+void Adafruit_NeoPixel::begin()
+{
+  m_begun = true;
+}
+
+void Adafruit_NeoPixel::show()
+{
+  if (!m_pixels)
+  {
+    return;
+  }
+  sim_record_show();
+  NativeSim::advance_us(sim_transmit_us());
+}
+
+void Adafruit_NeoPixel::sim_record_show()
+{
+  if (m_show_count++ == 0)
+  {
+    m_first_show_us = NativeSim::time_us();
+  }
+}
+
+void Adafruit_NeoPixel::setPin(int16_t p)
+{
+  m_pin = p;
+}
+
+void Adafruit_NeoPixel::updateLength(uint16_t n)
+{
+  free(m_pixels);
+  m_num_bytes = n * ((m_w_offset == m_r_offset) ? 3 : 4);
+  m_pixels = (uint8_t *)calloc(m_num_bytes, 1);
+  m_num_leds = m_pixels ? n : 0;
+  if (!m_pixels)
+  {
+    m_num_bytes = 0;
+  }
+}
+
+void Adafruit_NeoPixel::updateType(neoPixelType t)
+{
+  bool old_three_bytes = (m_w_offset == m_r_offset);
+  m_w_offset = (t >> 6) & 0b11;
+  m_r_offset = (t >> 4) & 0b11;
+  m_g_offset = (t >> 2) & 0b11;
+  m_b_offset = t & 0b11;
+  if (m_pixels && old_three_bytes != (m_w_offset == m_r_offset))
+  {
+    updateLength(m_num_leds);
+  }
+}
+
+void Adafruit_NeoPixel::setPixelColor(uint16_t n, uint8_t r, uint8_t g, uint8_t b)
+{
+  if (n >= m_num_leds)
+  {
+    return;
+  }
+  if (m_brightness)
+  {
+    r = (r * m_brightness) >> 8;
+    g = (g * m_brightness) >> 8;
+    b = (b * m_brightness) >> 8;
+  }
+  uint8_t *p;
+  if (m_w_offset == m_r_offset)
+  {
+    p = &m_pixels[n * 3];
+  }
+  else
+  {
+    p = &m_pixels[n * 4];
+    p[m_w_offset] = 0;
+  }
+  p[m_r_offset] = r;
+  p[m_g_offset] = g;
+  p[m_b_offset] = b;
+}
+
+void Adafruit_NeoPixel::setPixelColor(uint16_t n, uint8_t r, uint8_t g, uint8_t b, uint8_t w)
+{
+  if (n >= m_num_leds)
+  {
+    return;
+  }
+  if (m_brightness)
+  {
+    r = (r * m_brightness) >> 8;
+    g = (g * m_brightness) >> 8;
+    b = (b * m_brightness) >> 8;
+    w = (w * m_brightness) >> 8;
+  }
+  uint8_t *p;
+  if (m_w_offset == m_r_offset)
+  {
+    p = &m_pixels[n * 3];
+  }
+  else
+  {
+    p = &m_pixels[n * 4];
+    p[m_w_offset] = w;
+  }
+  p[m_r_offset] = r;
+  p[m_g_offset] = g;
+  p[m_b_offset] = b;
+}
+
+void Adafruit_NeoPixel::setPixelColor(uint16_t n, uint32_t c)
+{
+  setPixelColor(n, (uint8_t)(c >> 16), (uint8_t)(c >> 8), (uint8_t)c, (uint8_t)(c >> 24));
+}
+
+void Adafruit_NeoPixel::fill(uint32_t c, uint16_t first, uint16_t count)
+{
+  if (first >= m_num_leds)
+  {
+    return;
+  }
+  uint16_t end = (count == 0 || first + count > m_num_leds) ? m_num_leds : first + count;
+  for (uint16_t i = first; i < end; i++)
+  {
+    setPixelColor(i, c);
+  }
+}
+
+void Adafruit_NeoPixel::setBrightness(uint8_t b)
+{
+  // Stored as b + 1 so that 0 means "full brightness, don't scale". Unlike
+  // the real library this doesn't rescale already-set pixels.
+  m_brightness = b + 1;
+}
+
+void Adafruit_NeoPixel::clear()
+{
+  if (m_pixels)
+  {
+    memset(m_pixels, 0, m_num_bytes);
+  }
+}
+
+uint32_t Adafruit_NeoPixel::getPixelColor(uint16_t n) const
+{
+  if (n >= m_num_leds)
+  {
+    return 0;
+  }
+  uint32_t c;
+  if (m_w_offset == m_r_offset)
+  {
+    const uint8_t *p = &m_pixels[n * 3];
+    c = Color(p[m_r_offset], p[m_g_offset], p[m_b_offset]);
+  }
+  else
+  {
+    const uint8_t *p = &m_pixels[n * 4];
+    c = Color(p[m_r_offset], p[m_g_offset], p[m_b_offset], p[m_w_offset]);
+  }
+  if (m_brightness)
+  {
+    // Approximate inverse of the scaling in setPixelColor, as the real
+    // library does; lossy at low brightness.
+    uint32_t out = 0;
+    for (int k = 0; k < 32; k += 8)
+    {
+      out |= (uint32_t)((((c >> k) & 0xFF) << 8) / m_brightness) << k;
+    }
+    c = out;
+  }
+  return c;
+}
+
+uint8_t Adafruit_NeoPixel::sine8(uint8_t x)
+{
+  return (uint8_t)lround(127.5 + 127.5 * sin(2. * M_PI * x / 256.));
+}
+
+uint8_t Adafruit_NeoPixel::gamma8(uint8_t x)
+{
+  static uint8_t table[256];
+  static bool built = false;
+  if (!built)
+  {
+    for (int i = 0; i < 256; i++)
+    {
+      table[i] = (uint8_t)(pow(i / 255., 2.6) * 255. + 0.5);
+    }
+    built = true;
+  }
+  return table[x];
+}
+
+uint32_t Adafruit_NeoPixel::gamma32(uint32_t x)
+{
+  uint32_t out = 0;
+  for (int k = 0; k < 32; k += 8)
+  {
+    out |= (uint32_t)gamma8((x >> k) & 0xFF) << k;
+  }
+  return out;
+}
+
+uint32_t Adafruit_NeoPixel::ColorHSV(uint16_t hue, uint8_t sat, uint8_t val)
+{
+  // Hue is remapped to 0-1529 (six 255-step ramps: R->Y->G->C->B->M->R).
+  uint8_t r, g, b;
+  hue = (hue * 1530L + 32768) / 65536;
+  if (hue < 510)
+  {
+    b = 0;
+    if (hue < 255)
+    {
+      r = 255;
+      g = hue;
+    }
+    else
+    {
+      r = 510 - hue;
+      g = 255;
+    }
+  }
+  else if (hue < 1020)
+  {
+    r = 0;
+    if (hue < 765)
+    {
+      g = 255;
+      b = hue - 510;
+    }
+    else
+    {
+      g = 1020 - hue;
+      b = 255;
+    }
+  }
+  else if (hue < 1530)
+  {
+    g = 0;
+    if (hue < 1275)
+    {
+      r = hue - 1020;
+      b = 255;
+    }
+    else
+    {
+      r = 255;
+      b = 1530 - hue;
+    }
+  }
+  else
+  {
+    r = 255;
+    g = b = 0;
+  }
+
+  // Apply saturation and value.
+  uint32_t v1 = 1 + val;
+  uint16_t s1 = 1 + sat;
+  uint8_t s2 = 255 - sat;
+  return ((((((r * s1) >> 8) + s2) * v1) & 0xff00) << 8) |
+         (((((g * s1) >> 8) + s2) * v1) & 0xff00) |
+         (((((b * s1) >> 8) + s2) * v1) >> 8);
+}
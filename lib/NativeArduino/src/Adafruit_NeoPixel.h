@@ -0,0 +1,94 @@
+#pragma once
+
+// Host stand-in for Adafruit_NeoPixel. Pixels are stored in wire order
+// exactly like the real library; show() records the frame instead of
+// clocking it out, and advances the simulated clock by the time the real
+// transmission would have taken.
+
+#include <Arduino.h>
+
+typedef uint16_t neoPixelType;
+
+// Same encoding as the real library: 2 bits each for the byte offsets of
+// W, R, G and B within a pixel. W == R means there's no white channel.
+#define NEO_RGB ((0 << 6) | (0 << 4) | (1 << 2) | (2))
+#define NEO_RBG ((0 << 6) | (0 << 4) | (2 << 2) | (1))
+#define NEO_GRB ((1 << 6) | (1 << 4) | (0 << 2) | (2))
+#define NEO_BRG ((1 << 6) | (1 << 4) | (2 << 2) | (0))
+#define NEO_RGBW ((3 << 6) | (0 << 4) | (1 << 2) | (2))
+#define NEO_GRBW ((3 << 6) | (1 << 4) | (0 << 2) | (2))
+
+#define NEO_KHZ800 0x0000
+#define NEO_KHZ400 0x0100
+
+class Adafruit_NeoPixel
+{
+public:
+  Adafruit_NeoPixel(uint16_t n, int16_t pin = 6, neoPixelType type = NEO_GRB + NEO_KHZ800);
+  Adafruit_NeoPixel();
+  ~Adafruit_NeoPixel();
+
+  void begin();
+  void show();
+  void setPin(int16_t p);
+  void setPixelColor(uint16_t n, uint8_t r, uint8_t g, uint8_t b);
+  void setPixelColor(uint16_t n, uint8_t r, uint8_t g, uint8_t b, uint8_t w);
+  void setPixelColor(uint16_t n, uint32_t c);
+  void fill(uint32_t c = 0, uint16_t first = 0, uint16_t count = 0);
+  void setBrightness(uint8_t b);
+  void clear();
+  void updateLength(uint16_t n);
+  void updateType(neoPixelType t);
+  bool canShow() const { return true; }
+
+  uint8_t *getPixels() const { return m_pixels; }
+  uint8_t getBrightness() const { return m_brightness - 1; }
+  int16_t getPin() const { return m_pin; }
+  uint16_t numPixels() const { return m_num_leds; }
+  uint32_t getPixelColor(uint16_t n) const;
+
+  static uint8_t sine8(uint8_t x);
+  static uint8_t gamma8(uint8_t x);
+  static uint32_t Color(uint8_t r, uint8_t g, uint8_t b)
+  {
+    return ((uint32_t)r << 16) | ((uint32_t)g << 8) | b;
+  }
+  static uint32_t Color(uint8_t r, uint8_t g, uint8_t b, uint8_t w)
+  {
+    return ((uint32_t)w << 24) | ((uint32_t)r << 16) | ((uint32_t)g << 8) | b;
+  }
+  static uint32_t ColorHSV(uint16_t hue, uint8_t sat = 255, uint8_t val = 255);
+  static uint32_t gamma32(uint32_t x);
+
+  // Simulation hooks, not part of the real API.
+  uint16_t sim_num_bytes() const { return m_num_bytes; }
+  unsigned long sim_show_count() const { return m_show_count; }
+  // Counts a show without taking time, for output backends that simulate
+  // the transmission themselves (see AsyncStripOutput).
+  void sim_record_show();
+  // Simulated time of the first show(), or UINT64_MAX if none yet.
+  uint64_t sim_first_show_us() const { return m_first_show_us; }
+  // Time the real show() blocks for: 1.25us per bit plus the latch.
+  uint32_t sim_transmit_us() const { return m_num_bytes * 10 + 300; }
+
+  // Every strip constructed so far, for the harness and host tools.
+  static int sim_num_instances();
+  static Adafruit_NeoPixel *sim_instance(int i);
+
+private:
+  void register_instance();
+  void unregister_instance();
+
+  bool m_begun = false;
+  uint16_t m_num_leds = 0;
+  uint16_t m_num_bytes = 0;
+  int16_t m_pin = -1;
+  uint8_t m_brightness = 0;
+  uint8_t *m_pixels = nullptr;
+  uint8_t m_r_offset = 1;
+  uint8_t m_g_offset = 0;
+  uint8_t m_b_offset = 2;
+  uint8_t m_w_offset = 1;
+  unsigned long m_show_count = 0;
+  uint64_t m_first_show_us = UINT64_MAX;
+};
@@ -0,0 +1,142 @@
+#include "Arduino.h"
+
+NativeSerial Serial;
+
+namespace
+{
+  const int NUM_PINS = 64;
+
+  uint64_t g_time_us = 0;
+  int g_analog_raw = 2430;
+  int g_analog_noise = 0;
+  int g_analog_bits = 10;
+  int g_pin_states[NUM_PINS] = {0};
+  bool g_stop_requested = false;
+  int g_argc = 0;
+  char **g_argv = nullptr;
+}
+
+namespace NativeSim
+{
+  uint64_t time_us()
+  {
+    return g_time_us;
+  }
+
+  void set_time_us(uint64_t t)
+  {
+    g_time_us = t;
+  }
+
+  void advance_us(uint64_t dt)
+  {
+    g_time_us += dt;
+  }
+
+  void set_analog_raw(int raw_12bit)
+  {
+    g_analog_raw = raw_12bit;
+  }
+
+  void set_analog_noise(int amplitude)
+  {
+    g_analog_noise = amplitude;
+  }
+
+  int digital_pin_state(int pin)
+  {
+    return (pin >= 0 && pin < NUM_PINS) ? g_pin_states[pin] : LOW;
+  }
+
+  void stop()
+  {
+    g_stop_requested = true;
+  }
+
+  bool stop_requested()
+  {
+    return g_stop_requested;
+  }
+
+  void set_args(int argc, char **argv)
+  {
+    g_argc = argc;
+    g_argv = argv;
+  }
+
+  int argc()
+  {
+    return g_argc;
+  }
+
+  char **argv()
+  {
+    return g_argv;
+  }
+}
+
+void NativeSerial::sim_input(const char *text)
+{
+  // Drop what's been read, then append.
+  memmove(m_input, m_input + m_input_pos, m_input_length - m_input_pos);
+  m_input_length -= m_input_pos;
+  m_input_pos = 0;
+  while (*text && m_input_length < INPUT_SIZE)
+  {
+    m_input[m_input_length++] = *text++;
+  }
+}
+
+// Like the real core, millis() and micros() are 32-bit and wrap.
+unsigned long millis()
+{
+  return (uint32_t)(g_time_us / 1000);
+}
+
+unsigned long micros()
+{
+  return (uint32_t)g_time_us;
+}
+
+void delay(unsigned long ms)
+{
+  g_time_us += (uint64_t)ms * 1000;
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  g_time_us += us;
+}
+
+void pinMode(int pin, int mode)
+{
+}
+
+void digitalWrite(int pin, int value)
+{
+  if (pin >= 0 && pin < NUM_PINS)
+  {
+    g_pin_states[pin] = value;
+  }
+}
+
+int digitalRead(int pin)
+{
+  return NativeSim::digital_pin_state(pin);
+}
+
+int analogRead(int pin)
+{
+  int raw = g_analog_raw;
+  if (g_analog_noise > 0)
+  {
+    raw += rand() % (2 * g_analog_noise + 1) - g_analog_noise;
+  }
+  raw = constrain(raw, 0, 4095);
+  return g_analog_bits >= 12 ? raw << (g_analog_bits - 12) : raw >> (12 - g_analog_bits);
+}
+
+void analogReadResolution(int bits)
+{
+  g_analog_bits = bits;
+}
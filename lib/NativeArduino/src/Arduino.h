@@ -0,0 +1,98 @@
+#pragma once
+
+// Host stand-in for the Arduino core: just enough of it for the prop
+// sketches and the shared headers in include/ to compile and run on a PC
+// under a simulated clock. See NativeSim.h for the knobs that drive it.
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "NativeSim.h"
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define LED_BUILTIN 13
+
+template <class T, class L>
+auto min(const T &a, const L &b) -> decltype((b < a) ? b : a)
+{
+  return (b < a) ? b : a;
+}
+
+template <class T, class L>
+auto max(const T &a, const L &b) -> decltype((b < a) ? b : a)
+{
+  return (a < b) ? b : a;
+}
+
+template <class T, class L, class H>
+auto constrain(const T &x, const L &low, const H &high) -> decltype((x < low) ? low : ((x > high) ? high : x))
+{
+  return (x < low) ? low : ((x > high) ? high : x);
+}
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(int pin, int mode);
+void digitalWrite(int pin, int value);
+int digitalRead(int pin);
+int analogRead(int pin);
+void analogReadResolution(int bits);
+
+// Prints straight to stdout. Input is whatever the harness queued with
+// sim_input().
+class NativeSerial
+{
+public:
+  void begin(unsigned long baud) {}
+  operator bool() const { return true; }
+
+  int available() const { return m_input_length - m_input_pos; }
+  int read() { return m_input_pos < m_input_length ? (unsigned char)m_input[m_input_pos++] : -1; }
+
+  size_t print(const char *s) { return printf("%s", s); }
+  size_t print(char c) { return printf("%c", c); }
+  size_t print(int v) { return printf("%d", v); }
+  size_t print(unsigned int v) { return printf("%u", v); }
+  size_t print(long v) { return printf("%ld", v); }
+  size_t print(unsigned long v) { return printf("%lu", v); }
+  size_t print(double v, int digits = 2) { return printf("%.*f", digits, v); }
+
+  size_t println() { return printf("\n"); }
+  template <typename T>
+  size_t println(const T &v)
+  {
+    size_t n = print(v);
+    return n + println();
+  }
+  size_t println(double v, int digits) { return print(v, digits) + println(); }
+
+  // Queues text for read(), as if typed into the serial monitor. Anything
+  // past INPUT_SIZE unread bytes is dropped.
+  void sim_input(const char *text);
+
+private:
+  static const int INPUT_SIZE = 256;
+  char m_input[INPUT_SIZE];
+  int m_input_length = 0;
+  int m_input_pos = 0;
+};
+extern NativeSerial Serial;
+
+// Provided by the sketch.
+void setup();
+void loop();
@@ -0,0 +1,267 @@
+#include "ArduinoBLE.h"
+
+BLELocalDevice BLE;
+
+bool BLEDevice::disconnect()
+{
+  return BLE.disconnect();
+}
+
+BLECharacteristic::BLECharacteristic(const char *uuid, uint8_t properties, int valueSize, bool fixedLength)
+{
+  m_state = new State();
+  m_state->refs = 1;
+  m_state->uuid = uuid;
+  m_state->properties = properties;
+  m_state->value_size = valueSize;
+  m_state->fixed_length = fixedLength;
+  m_state->value = (uint8_t *)calloc(max(valueSize, 1), 1);
+  m_state->value_length = fixedLength ? valueSize : 0;
+}
+
+BLECharacteristic::BLECharacteristic(const char *uuid, uint8_t properties, const char *value)
+    : BLECharacteristic(uuid, properties, strlen(value), false)
+{
+  store((const uint8_t *)value, m_state->value_size);
+}
+
+BLECharacteristic::BLECharacteristic(State *state) : m_state(state)
+{
+  m_state->refs++;
+}
+
+BLECharacteristic::BLECharacteristic(const BLECharacteristic &other) : BLECharacteristic(other.m_state)
+{
+}
+
+BLECharacteristic &BLECharacteristic::operator=(const BLECharacteristic &other)
+{
+  if (other.m_state != m_state)
+  {
+    other.m_state->refs++;
+    release();
+    m_state = other.m_state;
+  }
+  return *this;
+}
+
+BLECharacteristic::~BLECharacteristic()
+{
+  release();
+}
+
+void BLECharacteristic::release()
+{
+  if (--m_state->refs == 0)
+  {
+    free(m_state->value);
+    delete m_state;
+  }
+}
+
+int BLECharacteristic::store(const uint8_t value[], int length)
+{
+  length = min(length, m_state->value_size);
+  memcpy(m_state->value, value, length);
+  if (!m_state->fixed_length)
+  {
+    m_state->value_length = length;
+  }
+  return 1;
+}
+
+int BLECharacteristic::readValue(uint8_t value[], int length)
+{
+  length = min(length, m_state->value_length);
+  memcpy(value, m_state->value, length);
+  return length;
+}
+
+int BLECharacteristic::writeValue(const uint8_t value[], int length, bool withResponse)
+{
+  m_state->local_write_count++;
+  return store(value, length);
+}
+
+int BLECharacteristic::writeValue(const void *value, int length, bool withResponse)
+{
+  return writeValue((const uint8_t *)value, length, withResponse);
+}
+
+int BLECharacteristic::writeValue(const char *value, bool withResponse)
+{
+  return writeValue((const uint8_t *)value, strlen(value), withResponse);
+}
+
+int BLECharacteristic::writeValue(uint8_t value, bool withResponse)
+{
+  return writeValue(&value, 1, withResponse);
+}
+
+bool BLECharacteristic::written()
+{
+  bool written = m_state->written;
+  m_state->written = false;
+  return written;
+}
+
+void BLECharacteristic::setEventHandler(BLECharacteristicEvent event, BLECharacteristicEventHandler handler)
+{
+  if (event == BLEWritten)
+  {
+    m_state->written_handler = handler;
+  }
+}
+
+void BLECharacteristic::sim_central_write(const uint8_t value[], int length)
+{
+  BLE.queue_written(m_state, value, length);
+}
+
+void BLEService::addCharacteristic(BLECharacteristic &characteristic)
+{
+  if (m_num_characteristics < MAX_CHARACTERISTICS)
+  {
+    m_characteristics[m_num_characteristics++] = &characteristic;
+  }
+}
+
+BLECharacteristic *BLEService::characteristic(int i) const
+{
+  return (i >= 0 && i < m_num_characteristics) ? m_characteristics[i] : nullptr;
+}
+
+int BLELocalDevice::begin()
+{
+  NativeSim::advance_us(m_begin_us);
+  if (m_begin_failures > 0)
+  {
+    m_begin_failures--;
+    return 0;
+  }
+  m_begun = true;
+  return 1;
+}
+
+void BLELocalDevice::end()
+{
+  m_begun = false;
+  m_advertising = false;
+  m_central_connected = false;
+  m_num_pending = 0;
+}
+
+void BLELocalDevice::queue_event(const PendingEvent &event)
+{
+  if (m_num_pending < MAX_PENDING_EVENTS)
+  {
+    m_pending[m_num_pending++] = event;
+  }
+}
+
+void BLELocalDevice::queue_written(BLECharacteristic::State *characteristic, const uint8_t value[], int length)
+{
+  PendingEvent event;
+  event.is_device_event = false;
+  event.characteristic = characteristic;
+  event.value_length = min(length, MAX_WRITE_SIZE);
+  memcpy(event.value, value, event.value_length);
+  queue_event(event);
+}
+
+void BLELocalDevice::poll(unsigned long timeout)
+{
+  m_poll_calls++;
+  // Handlers may queue more events; those wait for the next poll.
+  int num_pending = m_num_pending;
+  PendingEvent pending[MAX_PENDING_EVENTS];
+  memcpy(pending, m_pending, sizeof(PendingEvent) * num_pending);
+  m_num_pending = 0;
+  for (int i = 0; i < num_pending; i++)
+  {
+    if (pending[i].is_device_event)
+    {
+      BLEDeviceEventHandler handler = m_device_handlers[pending[i].device_event];
+      if (handler)
+      {
+        handler(BLEDevice(m_central_connected));
+      }
+      continue;
+    }
+    BLECharacteristic characteristic(pending[i].characteristic);
+    characteristic.store(pending[i].value, pending[i].value_length);
+    pending[i].characteristic->written = true;
+    if (pending[i].characteristic->written_handler)
+    {
+      pending[i].characteristic->written_handler(BLEDevice(m_central_connected), characteristic);
+    }
+  }
+}
+
+bool BLELocalDevice::setLocalName(const char *name)
+{
+  m_local_name = name;
+  return true;
+}
+
+bool BLELocalDevice::setAdvertisedService(const BLEService &service)
+{
+  return true;
+}
+
+void BLELocalDevice::addService(BLEService &service)
+{
+}
+
+int BLELocalDevice::advertise()
+{
+  m_advertising = m_begun;
+  return m_advertising;
+}
+
+void BLELocalDevice::stopAdvertise()
+{
+  m_advertising = false;
+}
+
+BLEDevice BLELocalDevice::central()
+{
+  m_central_calls++;
+  poll();
+  return BLEDevice(m_central_connected);
+}
+
+bool BLELocalDevice::disconnect()
+{
+  sim_disconnect_central();
+  return true;
+}
+
+void BLELocalDevice::setEventHandler(BLEDeviceEvent event, BLEDeviceEventHandler handler)
+{
+  if (event >= 0 && event < BLEDeviceLastEvent)
+  {
+    m_device_handlers[event] = handler;
+  }
+}
+
+void BLELocalDevice::sim_connect_central()
+{
+  if (!m_central_connected)
+  {
+    m_central_connected = true;
+    m_advertising = false;
+    queue_event({true, BLEConnected, nullptr});
+  }
+}
+
+void BLELocalDevice::sim_disconnect_central()
+{
+  if (m_central_connected)
+  {
+    m_central_connected = false;
+    // Like the real stack, go back to advertising once the central leaves.
+    m_advertising = m_begun;
+    queue_event({true, BLEDisconnected, nullptr});
+  }
+}
@@ -0,0 +1,234 @@
+#pragma once
+
+// Host stand-in for ArduinoBLE. There's no radio: a single simulated
+// central can be connected / disconnected, and can write characteristics,
+// through the sim_* hooks. As on the real stack, the resulting events are
+// queued and their handlers fire from inside BLE.poll() / BLE.central().
+
+#include <Arduino.h>
+
+enum BLEProperty
+{
+  BLEBroadcast = 0x01,
+  BLERead = 0x02,
+  BLEWriteWithoutResponse = 0x04,
+  BLEWrite = 0x08,
+  BLENotify = 0x10,
+  BLEIndicate = 0x20
+};
+
+enum BLEDeviceEvent
+{
+  BLEConnected = 0,
+  BLEDisconnected = 1,
+  BLEDeviceLastEvent
+};
+
+enum BLECharacteristicEvent
+{
+  BLESubscribed = 0,
+  BLEUnsubscribed = 1,
+  BLEWritten = 3,
+  BLEUpdated = BLEWritten,
+  BLECharacteristicEventLast
+};
+
+class BLEDevice
+{
+public:
+  BLEDevice(bool connected = false) : m_connected(connected) {}
+
+  operator bool() const { return m_connected; }
+  bool connected() const { return m_connected; }
+  const char *address() const { return "00:00:00:00:00:00"; }
+  bool disconnect();
+
+private:
+  bool m_connected;
+};
+
+class BLECharacteristic;
+typedef void (*BLEDeviceEventHandler)(BLEDevice device);
+typedef void (*BLECharacteristicEventHandler)(BLEDevice device, BLECharacteristic characteristic);
+
+// Like the real library, a BLECharacteristic is a handle: copies (e.g. the
+// one passed to an event handler) share the same value.
+class BLECharacteristic
+{
+public:
+  BLECharacteristic(const char *uuid, uint8_t properties, int valueSize, bool fixedLength = false);
+  BLECharacteristic(const char *uuid, uint8_t properties, const char *value);
+  BLECharacteristic(const BLECharacteristic &other);
+  BLECharacteristic &operator=(const BLECharacteristic &other);
+  virtual ~BLECharacteristic();
+
+  const char *uuid() const { return m_state->uuid; }
+  uint8_t properties() const { return m_state->properties; }
+  int valueSize() const { return m_state->value_size; }
+  const uint8_t *value() const { return m_state->value; }
+  int valueLength() const { return m_state->value_length; }
+  int readValue(uint8_t value[], int length);
+
+  int writeValue(const uint8_t value[], int length, bool withResponse = true);
+  int writeValue(const void *value, int length, bool withResponse = true);
+  int writeValue(const char *value, bool withResponse = true);
+  int writeValue(uint8_t value, bool withResponse = true);
+
+  // True once after each write from the central.
+  bool written();
+  bool subscribed() const { return false; }
+
+  void setEventHandler(BLECharacteristicEvent event, BLECharacteristicEventHandler handler);
+
+  bool operator==(const BLECharacteristic &other) const { return m_state == other.m_state; }
+
+  // Simulation hooks, not part of the real API.
+  void sim_central_write(const uint8_t value[], int length);
+  unsigned long sim_local_write_count() const { return m_state->local_write_count; }
+
+private:
+  friend class BLELocalDevice;
+
+  struct State
+  {
+    int refs;
+    const char *uuid;
+    uint8_t properties;
+    int value_size;
+    bool fixed_length;
+    uint8_t *value;
+    int value_length;
+    bool written;
+    unsigned long local_write_count;
+    BLECharacteristicEventHandler written_handler;
+  };
+
+  explicit BLECharacteristic(State *state);
+  int store(const uint8_t value[], int length);
+  void release();
+
+  State *m_state;
+};
+
+template <typename T>
+class BLETypedCharacteristic : public BLECharacteristic
+{
+public:
+  BLETypedCharacteristic(const char *uuid, unsigned int properties)
+      : BLECharacteristic(uuid, properties, sizeof(T), true)
+  {
+  }
+
+  int writeValue(T value)
+  {
+    return BLECharacteristic::writeValue((const uint8_t *)&value, sizeof(T));
+  }
+
+  T value()
+  {
+    T v = T();
+    memcpy(&v, BLECharacteristic::value(), min((int)sizeof(T), valueLength()));
+    return v;
+  }
+
+  void sim_central_write(T value)
+  {
+    BLECharacteristic::sim_central_write((const uint8_t *)&value, sizeof(T));
+  }
+};
+
+typedef BLETypedCharacteristic<bool> BLEBoolCharacteristic;
+typedef BLETypedCharacteristic<byte> BLEByteCharacteristic;
+typedef BLETypedCharacteristic<int> BLEIntCharacteristic;
+typedef BLETypedCharacteristic<unsigned int> BLEUnsignedIntCharacteristic;
+typedef BLETypedCharacteristic<long> BLELongCharacteristic;
+typedef BLETypedCharacteristic<unsigned long> BLEUnsignedLongCharacteristic;
+typedef BLETypedCharacteristic<float> BLEFloatCharacteristic;
+
+class BLEService
+{
+public:
+  static const int MAX_CHARACTERISTICS = 16;
+
+  BLEService(const char *uuid) : m_uuid(uuid) {}
+
+  const char *uuid() const { return m_uuid; }
+  void addCharacteristic(BLECharacteristic &characteristic);
+  int characteristicCount() const { return m_num_characteristics; }
+  BLECharacteristic *characteristic(int i) const;
+
+private:
+  const char *m_uuid;
+  BLECharacteristic *m_characteristics[MAX_CHARACTERISTICS];
+  int m_num_characteristics = 0;
+};
+
+class BLELocalDevice
+{
+public:
+  int begin();
+  void end();
+  void poll(unsigned long timeout = 0);
+
+  bool setLocalName(const char *name);
+  bool setAdvertisedService(const BLEService &service);
+  void addService(BLEService &service);
+  int advertise();
+  void stopAdvertise();
+  void setAdvertisingInterval(uint16_t advertisingInterval) { m_advertising_interval = advertisingInterval; }
+
+  BLEDevice central();
+  bool connected() const { return m_central_connected; }
+  bool disconnect();
+
+  void setEventHandler(BLEDeviceEvent event, BLEDeviceEventHandler handler);
+
+  // Simulation hooks, not part of the real API. Connection changes take
+  // effect immediately and their events fire on the next poll(). Central
+  // writes are queued, and each is applied to its characteristic right
+  // before its handler runs, so back-to-back writes aren't coalesced.
+  void sim_connect_central();
+  void sim_disconnect_central();
+  bool sim_advertising() const { return m_advertising; }
+  // In 0.625 ms units, like setAdvertisingInterval().
+  uint16_t sim_advertising_interval() const { return m_advertising_interval; }
+  const char *sim_local_name() const { return m_local_name; }
+  unsigned long sim_central_calls() const { return m_central_calls; }
+  unsigned long sim_poll_calls() const { return m_poll_calls; }
+  // The next n begin() calls fail, and each call takes begin_us of
+  // simulated time (the real stack takes a while to bring the radio up).
+  void sim_fail_begin(int n) { m_begin_failures = n; }
+  void sim_set_begin_us(uint32_t begin_us) { m_begin_us = begin_us; }
+
+private:
+  friend class BLECharacteristic;
+
+  static const int MAX_PENDING_EVENTS = 32;
+  static const int MAX_WRITE_SIZE = 512;
+  typedef struct PendingEvent
+  {
+    bool is_device_event;
+    BLEDeviceEvent device_event;
+    BLECharacteristic::State *characteristic;
+    int value_length;
+    uint8_t value[MAX_WRITE_SIZE];
+  } PendingEvent;
+
+  void queue_event(const PendingEvent &event);
+  void queue_written(BLECharacteristic::State *characteristic, const uint8_t value[], int length);
+
+  bool m_begun = false;
+  int m_begin_failures = 0;
+  uint32_t m_begin_us = 0;
+  bool m_advertising = false;
+  uint16_t m_advertising_interval = 160;
+  bool m_central_connected = false;
+  const char *m_local_name = "";
+  unsigned long m_central_calls = 0;
+  unsigned long m_poll_calls = 0;
+  BLEDeviceEventHandler m_device_handlers[BLEDeviceLastEvent] = {nullptr};
+  PendingEvent m_pending[MAX_PENDING_EVENTS];
+  int m_num_pending = 0;
+};
+
+extern BLELocalDevice BLE;
@@ -0,0 +1,123 @@
+// Entry point for host builds: runs the sketch's setup() and then loop()
+// under the simulated clock, and prints a summary of what the strips did
+// to stderr (stdout is left to the sketch, e.g. CSV from the host tools).
+//
+// Options:
+//   --seconds S      Simulated run time (default 10).
+//   --loop-us U      Simulated time charged to each loop() on top of
+//                    whatever the sketch itself spends (default 1000).
+//   --analog RAW     12-bit value returned by analogRead() (default 2430).
+//   --analog-noise N Uniform +-N counts of noise on analogRead().
+//   --connect        Connect a central right after setup().
+//   --ble-begin-ms MS
+//                    Simulated time each BLE.begin() takes (default 0).
+//   --ble-begin-failures N
+//                    Make the first N BLE.begin() calls fail.
+//   --serial TEXT    Serial input, arriving at the end of the run; the run
+//                    goes on for another second so the sketch can answer.
+//   -- ...           Everything after is left to the sketch, see
+//                    NativeSim::argv().
+//
+// Left out of unit test builds (pio test -e native-<prop>), where each test
+// under test/ has its own main() and drives the fakes directly.
+
+#include <Arduino.h>
+#include <Adafruit_NeoPixel.h>
+#include <ArduinoBLE.h>
+
+#ifndef UNIT_TEST
+
+int main(int argc, char **argv)
+{
+  double seconds = 10.;
+  uint64_t loop_us = 1000;
+  bool connect = false;
+  const char *serial_input = nullptr;
+  for (int i = 1; i < argc; i++)
+  {
+    bool has_value = i + 1 < argc;
+    if (!strcmp(argv[i], "--seconds") && has_value)
+    {
+      seconds = atof(argv[++i]);
+    }
+    else if (!strcmp(argv[i], "--loop-us") && has_value)
+    {
+      loop_us = strtoull(argv[++i], nullptr, 10);
+    }
+    else if (!strcmp(argv[i], "--analog") && has_value)
+    {
+      NativeSim::set_analog_raw(atoi(argv[++i]));
+    }
+    else if (!strcmp(argv[i], "--analog-noise") && has_value)
+    {
+      NativeSim::set_analog_noise(atoi(argv[++i]));
+    }
+    else if (!strcmp(argv[i], "--ble-begin-ms") && has_value)
+    {
+      BLE.sim_set_begin_us(atoi(argv[++i]) * 1000);
+    }
+    else if (!strcmp(argv[i], "--ble-begin-failures") && has_value)
+    {
+      BLE.sim_fail_begin(atoi(argv[++i]));
+    }
+    else if (!strcmp(argv[i], "--connect"))
+    {
+      connect = true;
+    }
+    else if (!strcmp(argv[i], "--serial") && has_value)
+    {
+      serial_input = argv[++i];
+    }
+    else if (!strcmp(argv[i], "--"))
+    {
+      NativeSim::set_args(argc - i - 1, argv + i + 1);
+      break;
+    }
+    else
+    {
+      fprintf(stderr, "Unknown option %s\n", argv[i]);
+      return 1;
+    }
+  }
+
+  setup();
+  uint64_t setup_us = NativeSim::time_us();
+  if (connect)
+  {
+    BLE.sim_connect_central();
+  }
+
+  unsigned long loops = 0;
+  auto run_until = [&](uint64_t end_us)
+  {
+    while (NativeSim::time_us() < end_us && !NativeSim::stop_requested())
+    {
+      loop();
+      loops++;
+      NativeSim::advance_us(loop_us);
+    }
+  };
+  run_until(setup_us + (uint64_t)(seconds * 1e6));
+  if (serial_input)
+  {
+    Serial.sim_input(serial_input);
+    run_until(NativeSim::time_us() + 1000000);
+  }
+
+  uint64_t run_us = NativeSim::time_us() - setup_us;
+  fprintf(stderr, "sim: setup took %.3f s, then %lu loops in %.3f s (%.1f loops/s)\n",
+                  setup_us / 1e6, loops, run_us / 1e6, run_us ? loops * 1e6 / run_us : 0.);
+  for (int i = 0; i < Adafruit_NeoPixel::sim_num_instances(); i++)
+  {
+    Adafruit_NeoPixel *strip = Adafruit_NeoPixel::sim_instance(i);
+    fprintf(stderr, "sim: strip on pin %d: %u pixels, %lu shows", strip->getPin(), strip->numPixels(), strip->sim_show_count());
+    if (strip->sim_show_count() > 0)
+    {
+      fprintf(stderr, ", first at %.3f s", strip->sim_first_show_us() / 1e6);
+    }
+    fprintf(stderr, "\n");
+  }
+  return 0;
+}
+
+#endif
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+
+// Controls for the host simulation. The fakes never touch real time: the
+// clock only moves when the harness (or a tool) advances it, when a sketch
+// calls delay(), or when a strip's show() "transmits".
+namespace NativeSim
+{
+  uint64_t time_us();
+  void set_time_us(uint64_t t);
+  void advance_us(uint64_t dt);
+
+  // Raw value returned by analogRead() on every pin, at 12 bits. The
+  // default reads as a ~3.9V battery through the props' divider.
+  void set_analog_raw(int raw_12bit);
+  // Adds uniform +-amplitude noise (in 12-bit counts) to every read.
+  void set_analog_noise(int amplitude);
+
+  int digital_pin_state(int pin);
+
+  // Set by tools that do all their work in setup(); the harness exits after
+  // the current loop() returns.
+  void stop();
+  bool stop_requested();
+
+  // Command line arguments after "--", left for tools that take their own
+  // options.
+  void set_args(int argc, char **argv);
+  int argc();
+  char **argv();
+}
@@ -0,0 +1,79 @@
+/**
+ *  Host benchmark for the per-loop cost of PropBLEManager::update.
+ *
+ *  Compares the event-driven update() against the old polling loop
+ *  (BLE.central() plus copying every control characteristic out each
+ *  loop), with a central connected and writing a new scene every N loops.
+ *  event_forced is update(true), as the props without a battery monitor
+ *  call it. Prints CSV, with the switch characteristic's local writes
+ *  (GATT updates) per loop:
+ *
+ *    pio run -e bench-ble && .pio/build/bench-ble/program > bench.csv
+ *
+ *  Only the decode / bookkeeping work is measured; the fake radio is free.
+ */
+
+#include <chrono>
+#include "PropBLEManager.h"
+
+PropBLEManager prop_ble_manager;
+
+const long LOOPS = 2000000;
+const int WRITE_EVERY[] = {0, 1000, 100, 10};
+
+// What update() did before it was event-driven.
+void polling_update(PropBLEManager &manager)
+{
+  BLEDevice central = BLE.central();
+  if (central && central.connected())
+  {
+    manager.led_enabled = manager.ble_switch_characteristic.value();
+    memcpy(manager.led_rgb_setting_1, manager.ble_rgb_1_characteristic.value(), 3);
+    memcpy(manager.led_rgb_setting_2, manager.ble_rgb_2_characteristic.value(), 3);
+    manager.control_mode = (ControlMode)manager.ble_mode_characteristic.value();
+  }
+}
+
+template <typename UpdateFn>
+void bench(const char *name, int write_every, UpdateFn update)
+{
+  uint8_t packed[PACKED_CONTROL_SIZE];
+  unsigned long switch_writes = prop_ble_manager.ble_switch_characteristic.sim_local_write_count();
+  auto start = std::chrono::steady_clock::now();
+  for (long i = 0; i < LOOPS; i++)
+  {
+    if (write_every && i % write_every == 0)
+    {
+      prop_ble_manager.control_sequence++;
+      prop_ble_manager.pack_control(packed);
+      prop_ble_manager.control_sequence--;
+      prop_ble_manager.ble_control_characteristic.sim_central_write(packed, PACKED_CONTROL_SIZE);
+    }
+    update();
+  }
+  auto end = std::chrono::steady_clock::now();
+  switch_writes = prop_ble_manager.ble_switch_characteristic.sim_local_write_count() - switch_writes;
+  printf("%s,%d,%.2f,%.4f\n", name, write_every, std::chrono::duration<double, std::nano>(end - start).count() / LOOPS,
+         (double)switch_writes / LOOPS);
+}
+
+void setup()
+{
+  prop_ble_manager.setup("Bench");
+  BLE.sim_connect_central();
+  printf("update,write_every_n_loops,ns_per_loop,switch_writes_per_loop\n");
+  for (int write_every : WRITE_EVERY)
+  {
+    bench("polling", write_every, []()
+          { polling_update(prop_ble_manager); });
+    bench("event", write_every, []()
+          { prop_ble_manager.update(false); });
+    bench("event_forced", write_every, []()
+          { prop_ble_manager.update(true); });
+  }
+  NativeSim::stop();
+}
+
+void loop()
+{
+}
@@ -0,0 +1,139 @@
+/**
+ *  Host benchmark for effect programs against the built-in effects.
+ *
+ *  Renders the Venat sword (150 + 4 pixels) with each built-in effect and
+ *  with an effect program written to look the same, and prints CSV:
+ *
+ *    pio run -e bench-effect && .pio/build/bench-effect/program > bench.csv
+ *
+ *  ops_per_pixel is exact (programs don't branch) and is the number to
+ *  watch on the target; the ns columns are host wall-clock for the whole
+ *  update(), only comparable between runs on the same machine.
+ *  host_frame_budget_used is ns_per_frame over a 60 fps frame on the
+ *  host, so it says nothing about the target's budget.
+ *
+ *  Everything runs on the host clock: effect time is wall-clock time since
+ *  the frames started, and the simulated clock never moves (transitions
+ *  are switched off instead of waited out).
+ */
+
+#include <chrono>
+#include <Adafruit_NeoPixel.h>
+#include "PropLayouts.h"
+#include "EffectAssembler.h"
+
+typedef struct Effect
+{
+  const char *name;
+  ControlMode builtin; // ControlMode::Program if there's no built-in twin.
+  const char *source;
+} Effect;
+
+const Effect EFFECTS[] = {
+    {"pulsing", ControlMode::DirectRGBPulsing,
+     // scale = 1 - 0.75 * (cos(a) * sin(b) + 1) / 2, a = 2x + t, b = x - t/2,
+     // x = i / 20, in radians; / 2pi for turns.
+     "i 0.0079577 mul store0 "
+     "load0 2 mul t 0.1591549 mul add cos "
+     "load0 t 0.0795775 mul sub sin "
+     "mul 1 add 0.375 mul 1 swap sub store1 "
+     "in_r load1 mul in_g load1 mul in_b load1 mul"},
+    {"flowing", ControlMode::PartyModeFlowing,
+     // x = i / 100 - t / 2; R = (cos(x) + 1) / 2, G = (cos(2x) + 1) / 2,
+     // B = (cos(3x) + 2) / 3, all scaled by the brightest input channel.
+     "in_r in_g max in_b max store1 "
+     "i 0.0015915 mul t 0.0795775 mul sub store0 "
+     "load0 cos 1 add 0.5 mul load1 mul "
+     "load0 2 mul cos 1 add 0.5 mul load1 mul "
+     "load0 3 mul cos 2 add 0.3333333 mul load1 mul"},
+    {"palette", ControlMode::Program,
+     "#ff0000 #ffff00 #00ff00 #00ffff #0000ff #ff00ff "
+     "i 0.01 mul t 0.1 mul add palette"},
+};
+
+const long FRAMES = 20000;
+
+// Drops frames instead of sending them. The fake Adafruit_NeoPixel::show()
+// moves the simulated clock on by each frame's transmit time, which has
+// nothing to do with the host time being measured.
+class DiscardOutput : public StripOutput
+{
+public:
+  void show() override
+  {
+  }
+
+  bool busy() override
+  {
+    return false;
+  }
+
+  void wait() override
+  {
+  }
+};
+
+template <typename Driver>
+double time_frames(Driver &driver, ControlMode mode)
+{
+  PropLEDDriverBase::ControlInput input = {0., true, {40, 60, 40}, mode};
+  // Straight into the mode, with no transition to time.
+  driver.m_transition_ms = 0;
+  driver.update(input);
+
+  auto start = std::chrono::steady_clock::now();
+  for (long f = 0; f < FRAMES; f++)
+  {
+    input.t = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    driver.update(input);
+  }
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() / FRAMES;
+}
+
+void print_row(const char *effect, const char *impl, int ops_per_pixel, double ns_per_frame)
+{
+  const int n_pixels = VenatLayout::LOGICAL_PIXELS;
+  printf("%s,%s,%d,%d,%.1f,%.2f,%.4f\n", effect, impl, n_pixels, ops_per_pixel,
+         ns_per_frame, ns_per_frame / n_pixels, ns_per_frame / (1e9 / 60));
+}
+
+void setup()
+{
+  Adafruit_NeoPixel strip_1(VenatLayout::Strip1::NUM_PIXELS, 10, NEO_GRB);
+  Adafruit_NeoPixel strip_2(VenatLayout::Strip2::NUM_PIXELS, 8, NEO_GRB);
+  strip_1.begin();
+  strip_2.begin();
+  DiscardOutput output_1;
+  DiscardOutput output_2;
+
+  printf("effect,impl,logical_pixels,ops_per_pixel,ns_per_frame,ns_per_pixel,host_frame_budget_used\n");
+  for (const Effect &effect : EFFECTS)
+  {
+    uint8_t program[EffectProgram::MAX_SIZE];
+    char error[128];
+    int length = EffectAssembler::assemble(effect.source, program, error, sizeof(error));
+    if (length < 0)
+    {
+      fprintf(stderr, "%s: %s\n", effect.name, error);
+      continue;
+    }
+
+    if (effect.builtin != ControlMode::Program)
+    {
+      PropLEDDriver<VenatLayout> driver;
+      driver.register_strips(&strip_1, &strip_2, &output_1, &output_2);
+      print_row(effect.name, "builtin", 0, time_frames(driver, effect.builtin));
+    }
+
+    PropLEDDriver<VenatLayout> driver;
+    driver.register_strips(&strip_1, &strip_2, &output_1, &output_2);
+    driver.load_program(program, length);
+    print_row(effect.name, "program", driver.m_program.num_ops(), time_frames(driver, ControlMode::Program));
+  }
+  NativeSim::stop();
+}
+
+void loop()
+{
+}
@@ -0,0 +1,102 @@
+/**
+ *  Host benchmark for strip output: how fast frames can go out with each
+ *  strip's blocking show() versus AsyncStripOutput, which renders the next
+ *  frame while the last one is still being sent and sends the strips
+ *  concurrently.
+ *
+ *  Runs update() back to back on the simulated clock, where only sending
+ *  takes time, so each frame is charged a render_us of simulated CPU time
+ *  first (the host is far faster than the prop's nRF52840; bench-render
+ *  gives an idea of the ratio). Prints CSV:
+ *
+ *    pio run -e bench-output && .pio/build/bench-output/program > output.csv
+ *
+ *  Also checks that each async strip's front buffer holds exactly the
+ *  frame that was rendered, and exits with 1 if not.
+ */
+
+#include <Adafruit_NeoPixel.h>
+#include "PropLayouts.h"
+
+typedef PropLayout<StripSpec<300, NEO_GRB>, StripSpec<300, NEO_GRB>> PlainLayout;
+
+const long FRAMES = 1000;
+const uint32_t RENDER_US[] = {0, 500, 1000, 2000, 5000, 10000};
+
+bool g_front_mismatch = false;
+
+template <typename Layout>
+double frame_us(bool async, uint32_t render_us)
+{
+  typedef typename Layout::Strip1 Strip1;
+  typedef typename Layout::Strip2 Strip2;
+  PropLEDDriver<Layout> driver;
+  Adafruit_NeoPixel strip_1(Strip1::NUM_PIXELS, 10, NEO_GRB);
+  Adafruit_NeoPixel strip_2(Strip2::NUM_PIXELS, 8, NEO_GRB);
+  AsyncStripOutput<Strip1> output_1(strip_1, 2);
+  AsyncStripOutput<Strip2> output_2(strip_2, 3);
+  strip_1.begin();
+  strip_2.begin();
+  if (async)
+  {
+    output_1.begin();
+    output_2.begin();
+    driver.register_strips(&strip_1, &strip_2, &output_1, &output_2);
+  }
+  else
+  {
+    driver.register_strips(&strip_1, &strip_2);
+  }
+
+  // Flowing changes every pixel every frame, so every frame goes out.
+  PropLEDDriverBase::ControlInput input = {0., true, {40, 60, 40}, ControlMode::PartyModeFlowing};
+  driver.m_transition_ms = 0;
+  driver.update(input);
+
+  uint64_t start_us = NativeSim::time_us();
+  for (long f = 0; f < FRAMES; f++)
+  {
+    NativeSim::advance_us(render_us);
+    input.t = NativeSim::time_us() / 1e6;
+    driver.update(input);
+    if (async && (memcmp(output_1.front(), strip_1.getPixels(), Strip1::NUM_BYTES) ||
+                  memcmp(output_2.front(), strip_2.getPixels(), Strip2::NUM_BYTES)))
+    {
+      g_front_mismatch = true;
+    }
+  }
+  // The last frame is only out once it's finished sending.
+  output_1.wait();
+  output_2.wait();
+  return (double)(NativeSim::time_us() - start_us) / FRAMES;
+}
+
+template <typename Layout>
+void bench_layout(const char *layout_name)
+{
+  int pixels = Layout::Strip1::NUM_PIXELS + Layout::Strip2::NUM_PIXELS;
+  for (uint32_t render_us : RENDER_US)
+  {
+    double blocking_us = frame_us<Layout>(false, render_us);
+    double async_us = frame_us<Layout>(true, render_us);
+    printf("%s,%d,%lu,%.1f,%.1f,%.1f,%.1f,%.2f\n", layout_name, pixels, (unsigned long)render_us, blocking_us,
+           async_us, 1e6 / blocking_us, 1e6 / async_us, blocking_us / async_us);
+  }
+}
+
+void setup()
+{
+  printf("layout,pixels,render_us,blocking_us_per_frame,async_us_per_frame,blocking_fps,async_fps,speedup\n");
+  bench_layout<VenatLayout>("venat");
+  bench_layout<PlainLayout>("plain-2x300");
+  if (g_front_mismatch)
+  {
+    fprintf(stderr, "front buffer didn't match the rendered frame\n");
+    exit(1);
+  }
+  NativeSim::stop();
+}
+
+void loop()
+{
+}
@@ -0,0 +1,220 @@
+/**
+ *  Host benchmark for PropLEDDriver::update.
+ *
+ *  Times every ControlMode across a sweep of strip lengths and strip
+ *  counts, with the plain layout (strips mirroring each other), with the
+ *  SwordLayout segment map, and with up to 8 strips laid end to end in the
+ *  logical framebuffer (chain),
+ *  with solid-color frames filled a span at a time (solid_fill = 1) and
+ *  converted pixel by pixel (0), and prints one CSV row per configuration:
+ *
+ *    pio run -e bench-render && .pio/build/bench-render/program > bench.csv
+ *
+ *  Times are host wall-clock for the whole update() (render, dirty check
+ *  and the fake show()), so they're only comparable between runs on the
+ *  same machine.
+ *
+ *  With -- --trig it instead compares the per-pixel math of the pulsing
+ *  and flowing effects done with double cos/sin (as the effects used to)
+ *  against FixedTrig's table, and prints the time per frame for each and
+ *  the largest difference in 8-bit output levels:
+ *
+ *    .pio/build/bench-render/program -- --trig > trig.csv
+ */
+
+#include <chrono>
+#include <memory>
+#include <utility>
+#include <vector>
+#include <Adafruit_NeoPixel.h>
+#include "SwordLayout.h"
+
+const ControlMode MODES[] = {ControlMode::DirectRGB, ControlMode::DirectRGBPulsing,
+                             ControlMode::PartyModeFlowing, ControlMode::PartyModeRolling};
+const char *MODE_NAMES[] = {"DirectRGB", "DirectRGBPulsing", "PartyModeFlowing", "PartyModeRolling"};
+
+// Keep each configuration to roughly this many pixel-updates.
+const long PIXELS_PER_CONFIG = 2000000;
+// Simulated frame period, so time-varying effects actually vary.
+const uint64_t FRAME_US = 16667;
+
+// Every strip of the layout must be NEO_GRB and Strip1's length.
+template <typename Layout>
+void bench_config(const char *layout_name, int mode_index, bool solid_fill)
+{
+  const int n_strips = Layout::NUM_STRIPS;
+  const int n_pixels = Layout::Strip1::NUM_PIXELS;
+
+  PropLEDDriver<Layout> driver;
+  std::vector<std::unique_ptr<Adafruit_NeoPixel>> strips;
+  for (int k = 0; k < n_strips; k++)
+  {
+    strips.emplace_back(new Adafruit_NeoPixel(n_pixels, 10 + k, NEO_GRB));
+    strips[k]->begin();
+    driver.register_strip(k, strips[k].get());
+  }
+  driver.m_solid_fill = solid_fill;
+
+  PropLEDDriverBase::ControlInput input = {0., true, {40, 60, 40}, MODES[mode_index]};
+
+  // Switch into the mode and let the transition finish before timing.
+  driver.update(input);
+  NativeSim::advance_us(1000000000);
+
+  long frames = max(PIXELS_PER_CONFIG / (n_strips * n_pixels), 100L);
+  PropLEDDriverBase::FrameStats stats_before = driver.m_frame_stats;
+  auto start = std::chrono::steady_clock::now();
+  for (long f = 0; f < frames; f++)
+  {
+    NativeSim::advance_us(FRAME_US);
+    input.t = NativeSim::time_us() / 1e6;
+    driver.update(input);
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  double ns_per_frame = std::chrono::duration<double, std::nano>(end - start).count() / frames;
+  unsigned long pushed = driver.m_frame_stats.frames_pushed - stats_before.frames_pushed;
+  printf("%s,%s,%d,%d,%d,%ld,%.1f,%.3f,%.1f,%.3f\n",
+         MODE_NAMES[mode_index], layout_name, n_strips, n_pixels, solid_fill, frames,
+         ns_per_frame, ns_per_frame / (n_strips * n_pixels), 1e9 / ns_per_frame,
+         (double)pushed / (frames * n_strips));
+}
+
+// N-pixel strips end to end: strip k shows logical pixels k * N onwards.
+template <uint16_t N, size_t... K>
+PropLayout<StripSpec<N, NEO_GRB, K * N>...> chain_layout(std::index_sequence<K...>);
+template <uint16_t N, size_t STRIPS>
+using ChainLayout = decltype(chain_layout<N>(std::make_index_sequence<STRIPS>()));
+
+// One strip length: plain and sword layouts, one and two strips, and
+// chains of 2 to 8, with and without span fills.
+template <uint16_t N>
+void bench_length(int mode_index)
+{
+  typedef StripSpec<N, NEO_GRB> Strip;
+  for (int solid_fill = 1; solid_fill >= 0; solid_fill--)
+  {
+    bench_config<PropLayout<Strip>>("plain", mode_index, solid_fill);
+    // Same proportions as the Venat blade: 60 / 150 / 45.
+    bench_config<SwordLayout<N * 2 / 5, N, N * 3 / 10>>("sword", mode_index, solid_fill);
+    bench_config<PropLayout<Strip, Strip>>("plain", mode_index, solid_fill);
+    bench_config<SwordLayout<N * 2 / 5, N, N * 3 / 10, Strip>>("sword", mode_index, solid_fill);
+    bench_config<ChainLayout<N, 2>>("chain", mode_index, solid_fill);
+    bench_config<ChainLayout<N, 4>>("chain", mode_index, solid_fill);
+    bench_config<ChainLayout<N, 8>>("chain", mode_index, solid_fill);
+  }
+}
+
+template <uint16_t... LENGTHS>
+void bench_lengths(int mode_index)
+{
+  (bench_length<LENGTHS>(mode_index), ...);
+}
+
+// Pulsing scale and flowing colour for a strip of n pixels, with doubles
+// (the effects before FixedTrig) and with the table, as 8-bit levels.
+void pulsing_double(int n, double t, uint8_t out[])
+{
+  for (int i = 0; i < n; i++)
+  {
+    double x = i / 20.;
+    double noise = (cos(2 * x + t) * sin(x - 0.5 * t) + 1) / 2.;
+    out[i] = 255 * (1. - 0.75 * noise);
+  }
+}
+
+void pulsing_lut(int n, double t, uint8_t out[])
+{
+  const FixedTrig::Phase step_x = FixedTrig::phase_from_radians(1. / 20.);
+  const FixedTrig::Phase a_0 = FixedTrig::phase_from_radians(t);
+  const FixedTrig::Phase b_0 = FixedTrig::phase_from_radians(-0.5 * t);
+  for (int i = 0; i < n; i++)
+  {
+    int32_t noise = (FixedTrig::mul_q15(FixedTrig::cos_q15(a_0 + 2 * i * step_x), FixedTrig::sin_q15(b_0 + i * step_x)) +
+                     FixedTrig::Q15_ONE) >>
+                    1;
+    uint32_t scale = (1 << 15) - ((3 * noise) >> 2);
+    out[i] = (scale * 255) >> 15;
+  }
+}
+
+void flowing_double(int n, double t, uint8_t out[])
+{
+  for (int i = 0; i < n; i++)
+  {
+    double x = i / 100. - 0.5 * t;
+    out[3 * i] = 255 * (cos(x) + 1.) / 2.;
+    out[3 * i + 1] = 255 * (cos(2 * x) + 1.) / 2.;
+    out[3 * i + 2] = 255 * (cos(3 * x) + 2.) / 3.;
+  }
+}
+
+void flowing_lut(int n, double t, uint8_t out[])
+{
+  const FixedTrig::Phase step_x = FixedTrig::phase_from_radians(1. / 100.);
+  const FixedTrig::Phase x_0 = FixedTrig::phase_from_radians(-0.5 * t);
+  for (int i = 0; i < n; i++)
+  {
+    FixedTrig::Phase x = x_0 + i * step_x;
+    out[3 * i] = (255 * (FixedTrig::cos_q15(x) + 32768)) >> 16;
+    out[3 * i + 1] = (255 * (FixedTrig::cos_q15(2 * x) + 32768)) >> 16;
+    out[3 * i + 2] = 255 * (FixedTrig::cos_q15(3 * x) + 65536) / (3 * 32768);
+  }
+}
+
+typedef void (*TrigEffect)(int n, double t, uint8_t out[]);
+
+double time_trig_frames(TrigEffect effect, int n, long frames, uint8_t out[])
+{
+  auto start = std::chrono::steady_clock::now();
+  for (long f = 0; f < frames; f++)
+  {
+    effect(n, f * (FRAME_US / 1e6), out);
+  }
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() / frames;
+}
+
+void bench_trig(const char *effect_name, TrigEffect double_effect, TrigEffect lut_effect, int channels)
+{
+  for (int n : {30, 150, 300, 600})
+  {
+    std::vector<uint8_t> double_out(n * channels), lut_out(n * channels);
+    long frames = max(PIXELS_PER_CONFIG / n, 100L);
+    double double_ns = time_trig_frames(double_effect, n, frames, double_out.data());
+    double lut_ns = time_trig_frames(lut_effect, n, frames, lut_out.data());
+    // Both end on the same frame, so compare their outputs.
+    int max_diff = 0;
+    for (int i = 0; i < n * channels; i++)
+    {
+      max_diff = max(max_diff, abs(double_out[i] - lut_out[i]));
+    }
+    printf("%s,%d,%.1f,%.1f,%.2f,%d\n", effect_name, n, double_ns, lut_ns, double_ns / lut_ns, max_diff);
+  }
+}
+
+void setup()
+{
+  for (int i = 0; i < NativeSim::argc(); i++)
+  {
+    if (!strcmp(NativeSim::argv()[i], "--trig"))
+    {
+      printf("effect,pixels,double_ns_per_frame,lut_ns_per_frame,speedup,max_level_diff\n");
+      bench_trig("pulsing", pulsing_double, pulsing_lut, 1);
+      bench_trig("flowing", flowing_double, flowing_lut, 3);
+      NativeSim::stop();
+      return;
+    }
+  }
+
+  printf("mode,layout,strips,pixels_per_strip,solid_fill,frames,ns_per_frame,ns_per_pixel,fps,pushes_per_strip_frame\n");
+  for (int mode_index = 0; mode_index < 4; mode_index++)
+  {
+    bench_lengths<1, 4, 7, 30, 60, 150, 300, 600>(mode_index);
+  }
+  NativeSim::stop();
+}
+
+void loop()
+{
+}
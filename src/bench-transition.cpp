@@ -0,0 +1,101 @@
+/**
+ *  Host benchmark for mode transitions: what rendering the outgoing effect
+ *  as well as the incoming one, and blending them, adds to a frame.
+ *
+ *  For every pair of built-in effects and both transition types, times
+ *  update() on the Venat sword (150 + 4 pixels) and on a plain 300 pixel
+ *  strip, once settled in the incoming mode and once held mid-transition,
+ *  and prints CSV:
+ *
+ *    pio run -e bench-transition && .pio/build/bench-transition/program > bench.csv
+ *
+ *  Times are host wall-clock for the whole update(), only comparable
+ *  between runs on the same machine.
+ */
+
+#include <chrono>
+#include <Adafruit_NeoPixel.h>
+#include "PropLayouts.h"
+
+typedef PropLayout<StripSpec<300, NEO_GRB>> PlainLayout;
+
+const ControlMode MODES[] = {ControlMode::DirectRGB, ControlMode::DirectRGBPulsing,
+                             ControlMode::PartyModeFlowing, ControlMode::PartyModeRolling};
+const char *MODE_NAMES[] = {"DirectRGB", "DirectRGBPulsing", "PartyModeFlowing", "PartyModeRolling"};
+const char *TRANSITION_NAMES[] = {"crossfade", "wipe"};
+
+const long FRAMES = 20000;
+const uint64_t FRAME_US = 16667;
+
+template <typename Driver>
+double time_frames(Driver &driver, PropLEDDriverBase::ControlInput &input)
+{
+  auto start = std::chrono::steady_clock::now();
+  for (long f = 0; f < FRAMES; f++)
+  {
+    NativeSim::advance_us(FRAME_US);
+    input.t = NativeSim::time_us() / 1e6;
+    driver.update(input);
+  }
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() / FRAMES;
+}
+
+template <typename Layout>
+void bench_pair(const char *layout_name, int from, int to, PropLEDDriverBase::TransitionType type)
+{
+  typedef typename Layout::Strip1 Strip1;
+  typedef typename Layout::Strip2 Strip2;
+  PropLEDDriver<Layout> driver;
+  Adafruit_NeoPixel strip_1(Strip1::NUM_PIXELS, 10, NEO_GRB);
+  Adafruit_NeoPixel strip_2(Strip2::NUM_PIXELS, 8, NEO_GRB);
+  strip_1.begin();
+  strip_2.begin();
+  driver.register_strips(&strip_1, &strip_2);
+  driver.m_transition_type = type;
+
+  PropLEDDriverBase::ControlInput input = {0., true, {40, 60, 40}, MODES[to]};
+  driver.update(input);
+  NativeSim::advance_us(1000000000);
+  double steady_ns = time_frames(driver, input);
+
+  // Go back to the outgoing mode, then switch with a transition long enough
+  // to last the whole timed run; it stays mid-blend throughout.
+  input.control_mode = MODES[from];
+  driver.update(input);
+  NativeSim::advance_us(1000000000);
+  driver.m_transition_ms = 1000000000;
+  input.control_mode = MODES[to];
+  driver.update(input);
+  double transition_ns = time_frames(driver, input);
+
+  int pixels = Strip1::NUM_PIXELS + Strip2::NUM_PIXELS;
+  printf("%s,%s,%s,%s,%d,%.1f,%.1f,%.1f,%.3f\n", MODE_NAMES[from], MODE_NAMES[to], TRANSITION_NAMES[type],
+         layout_name, pixels, steady_ns, transition_ns, transition_ns - steady_ns,
+         (transition_ns - steady_ns) / pixels);
+}
+
+void setup()
+{
+  printf("from,to,transition,layout,pixels,steady_ns_per_frame,transition_ns_per_frame,extra_ns_per_frame,extra_ns_per_pixel\n");
+  for (int from = 0; from < 4; from++)
+  {
+    for (int to = 0; to < 4; to++)
+    {
+      if (from == to)
+      {
+        continue;
+      }
+      for (int type = PropLEDDriverBase::Crossfade; type <= PropLEDDriverBase::Wipe; type++)
+      {
+        bench_pair<VenatLayout>("venat", from, to, (PropLEDDriverBase::TransitionType)type);
+        bench_pair<PlainLayout>("plain", from, to, (PropLEDDriverBase::TransitionType)type);
+      }
+    }
+  }
+  NativeSim::stop();
+}
+
+void loop()
+{
+}
@@ -0,0 +1,46 @@
+/**
+ *  Host compiler for effect programs (see EffectAssembler.h for the
+ *  language and EffectProgram.h for the bytecode).
+ *
+ *  Reads source on stdin and prints the program as hex on stdout, ready to
+ *  write to the program characteristic (...8008) from e.g. nRF Connect:
+ *
+ *    pio run -e effect-compiler
+ *    echo "#ff0000 #0000ff i 0.01 mul t 0.1 mul add palette" | .pio/build/effect-compiler/program
+ *
+ *  Then select ControlMode::Program.
+ */
+
+#include <Arduino.h>
+#include "EffectAssembler.h"
+
+void setup()
+{
+  static char source[16384];
+  size_t n = fread(source, 1, sizeof(source) - 1, stdin);
+  source[n] = 0;
+
+  uint8_t program[EffectProgram::MAX_SIZE];
+  char error[128];
+  int length = EffectAssembler::assemble(source, program, error, sizeof(error));
+  if (length < 0)
+  {
+    fprintf(stderr, "error: %s\n", error);
+    exit(1);
+  }
+
+  for (int i = 0; i < length; i++)
+  {
+    printf("%02X", program[i]);
+  }
+  printf("\n");
+
+  EffectProgram loaded;
+  loaded.load(program, length);
+  fprintf(stderr, "%d bytes, %d ops per pixel\n", length, loaded.num_ops());
+  NativeSim::stop();
+}
+
+void loop()
+{
+}
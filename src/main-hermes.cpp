@@ -12,28 +12,40 @@
  */
 
 #include <Adafruit_NeoPixel.h>
-#include "PropLEDDriver.h"
+#include "PropLayouts.h"
 #include "PropBLEManager.h"
 #include "StatusLEDManager.h"
+#include "TaskScheduler.h"
 
 // LED strip setup information
 const int PIN_LEDS = 10;
-const int N_PIXELS = 7;
 
-Adafruit_NeoPixel pixels_1 = Adafruit_NeoPixel(N_PIXELS, PIN_LEDS, NEO_GRBW);
+Adafruit_NeoPixel pixels_1 = Adafruit_NeoPixel(HermesLayout::Strip1::NUM_PIXELS, PIN_LEDS, NEO_GRBW);
 
-PropLEDDriver prop_led_driver;
-StatusLEDManager status_led_manager(LED_BUILTIN);
+// The strip goes out on a PWM peripheral while the next frame renders.
+AsyncStripOutput<HermesLayout::Strip1> output_1(pixels_1, 2);
+PropLEDDriver<HermesLayout> prop_led_driver;
+// The XIAO's LED_BUILTIN is lit by driving the pin low.
+StatusLEDManager status_led_manager(LED_BUILTIN, true);
 PropBLEManager prop_ble_manager;
+TaskScheduler scheduler;
+const float RENDER_FPS = 60;
+// Once switched off and dark, the render task only checks for being
+// switched back on.
+const float IDLE_RENDER_FPS = 10;
+int render_task_id = -1;
+int setup_task_id = -1;
+// setup_task retries once a second at first, backing off to this.
+const unsigned long SETUP_RETRY_MAX_US = 30000000;
+// Set once each has come up; until then setup_task retries it.
+bool leds_ready = false;
+bool ble_ready = false;
+// Estimated LED draw is held under this, for the pack and regulator; see
+// CurrentLimiter.h.
+const unsigned long LED_CURRENT_BUDGET_MA = 500;
 
-bool setup_leds()
-{
-  pixels_1.begin();
-  prop_led_driver.register_strips(&pixels_1, nullptr);
-  return true;
-}
-
-bool setup_ble()
+// What the LEDs show from the first frame, before any central connects.
+void set_startup_control()
 {
   prop_ble_manager.led_enabled = true;
   // Start in medium-brightness rainbow mode
@@ -44,68 +56,160 @@ bool setup_ble()
   prop_ble_manager.led_rgb_setting_2[1] = 60;
   prop_ble_manager.led_rgb_setting_2[2] = 40;
   prop_ble_manager.control_mode = ControlMode::PartyModeFlowing;
+}
 
+bool setup_leds()
+{
+  pixels_1.begin();
+  return output_1.begin() && prop_led_driver.register_strips(&pixels_1, nullptr, &output_1);
+}
+
+bool setup_ble()
+{
   if (!prop_ble_manager.setup("Hermes-Staff"))
   {
     Serial.println("starting Bluetooth® Low Energy module failed!");
     return false;
   }
+  // No battery to read.
+  prop_ble_manager.publish_battery_voltage(3.1415);
   return true;
 }
 
-void setup()
+// Retries whatever failed to come up while everything else runs. The status
+// LED shows what's still missing.
+//
+// BLE.begin() blocks until the radio is up or has failed, and no other task
+// runs meanwhile: the LEDs hold their last frame for as long as it takes.
+// So each BLE failure doubles the wait before the next try, up to
+// SETUP_RETRY_MAX_US, and a radio that keeps failing slowly stalls the
+// render less and less often.
+void setup_task()
 {
-  Serial.begin(9600);
-  // Prep for battery voltage reading.
-  analogReadResolution(12);
-  status_led_manager.setup();
-
-  // Flip LED 3 times if failed to setup LEDs.
-  while (!setup_leds())
+  if (!leds_ready && !(leds_ready = setup_leds()))
   {
     Serial.println("Failed to setup LEDs.");
-    status_led_manager.flip_time_ms = 100;
-    unsigned long start_t = millis();
-    while (millis() - start_t < 1000)
-    {
-      status_led_manager.update();
-    }
-    delay(1000);
   }
-
-  // Flip LED 5 times if failed to setup BLE.
-  while (!setup_ble())
+  if (!ble_ready && !(ble_ready = setup_ble()))
   {
     Serial.println("Failed to setup BLE.");
-    status_led_manager.flip_time_ms = 250;
-    unsigned long start_t = millis();
-    while (millis() - start_t < 2000)
-    {
-      status_led_manager.update();
-    }
-    delay(1000);
+    scheduler.set_period(setup_task_id, min(2 * scheduler.task(setup_task_id).period_us, SETUP_RETRY_MAX_US));
   }
 }
 
-void loop()
+void ble_task()
 {
-  double t = ((double)millis()) / 1000.;
+  if (!ble_ready)
+  {
+    return;
+  }
+  prop_ble_manager.update(true);
+  if (prop_ble_manager.effect_program_uploaded() &&
+      !prop_led_driver.load_program(prop_ble_manager.effect_program, prop_ble_manager.effect_program_length))
+  {
+    Serial.println("Rejected invalid effect program.");
+  }
+}
 
-  // No battery to read.
-  prop_ble_manager.update(true, 3.1415);
+void render_task()
+{
+  // Local time until a central sends its clock; see ClockSync.h.
+  double t = prop_ble_manager.clock_sync.now_seconds();
   prop_led_driver.update(
       {t,
        prop_ble_manager.led_enabled,
        {prop_ble_manager.led_rgb_setting_1[0], prop_ble_manager.led_rgb_setting_1[1], prop_ble_manager.led_rgb_setting_1[2]},
        prop_ble_manager.control_mode});
+  scheduler.set_period(render_task_id, 1000000 / (prop_led_driver.idle() ? IDLE_RENDER_FPS : RENDER_FPS));
+}
 
-  if (prop_ble_manager.led_enabled)
+void stats_task()
+{
+  if (!ble_ready)
   {
-    status_led_manager.flip_time_ms = 250;
+    return;
+  }
+  prop_ble_manager.publish_frame_rate(prop_led_driver.m_governor.achieved_fps());
+  prop_ble_manager.publish_current_draw(prop_led_driver.m_current_limiter.estimated_ma());
+  prop_ble_manager.publish_keyframe_stats();
+  prop_ble_manager.publish_profile();
+}
+
+// Serial commands: 'p' prints the stage profile, 't' the task scheduler's
+// stats (overruns and worst lateness per task), 'r' resets both.
+void serial_task()
+{
+  while (Serial.available() > 0)
+  {
+    int command = Serial.read();
+    if (command == 'p')
+    {
+      StageProfiler::instance().dump(Serial);
+    }
+    else if (command == 't')
+    {
+      scheduler.dump(Serial);
+    }
+    else if (command == 'r')
+    {
+      StageProfiler::instance().reset();
+      scheduler.reset_stats();
+    }
+  }
+}
+
+void status_led_task()
+{
+  // 3 flashes: LEDs failed to set up. 5 flashes: BLE failed to set up.
+  // 2 Hz: LEDs on. Heartbeat: LEDs off.
+  if (!leds_ready)
+  {
+    status_led_manager.blink_code(3);
+  }
+  else if (!ble_ready)
+  {
+    status_led_manager.blink_code(5);
+  }
+  else if (prop_ble_manager.led_enabled)
+  {
+    status_led_manager.blink(250);
   }
   else
   {
-    status_led_manager.flip_time_ms = 500;
+    status_led_manager.heartbeat();
   }
   status_led_manager.update();
-}
\ No newline at end of file
+}
+
+void setup()
+{
+  Serial.begin(9600);
+  // Prep for battery voltage reading.
+  analogReadResolution(12);
+  status_led_manager.setup();
+
+  set_startup_control();
+  // LEDs first, so the first frame goes out before BLE has started (it's
+  // the slow part); setup_task brings up BLE and retries anything that
+  // failed.
+  leds_ready = setup_leds();
+
+  prop_led_driver.register_keyframes(&prop_ble_manager.keyframes);
+
+  // Most urgent first: tasks that come due together run in this order.
+  scheduler.add_task("ble", ble_task, 1000000 / 20);
+  prop_led_driver.m_current_limiter.budget_ma = LED_CURRENT_BUDGET_MA;
+  prop_led_driver.m_governor.target_fps = RENDER_FPS;
+  render_task_id = scheduler.add_task("render", render_task, 1000000 / RENDER_FPS);
+  scheduler.add_task("status_led", status_led_task, StatusLEDManager::STEP_MS * 1000);
+  scheduler.add_task("stats", stats_task, 1000000 / 1);
+  scheduler.add_task("serial", serial_task, 1000000 / 10);
+  // Last, so the first frame goes out before BLE starts.
+  setup_task_id = scheduler.add_task("setup", setup_task, 1000000 / 1);
+}
+
+void loop()
+{
+  scheduler.update();
+  scheduler.sleep_until_due();
+}
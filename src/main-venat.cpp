@@ -12,9 +12,11 @@
  */
 
 #include <Adafruit_NeoPixel.h>
-#include "PropLEDDriver.h"
+#include "PropLayouts.h"
 #include "PropBLEManager.h"
 #include "StatusLEDManager.h"
+#include "TaskScheduler.h"
+#include "BatteryMonitor.h"
 
 /*
 
@@ -35,56 +37,39 @@ Fancy control modes, and a way to control them:
 // LED strip setup information
 const int PIN_LEDS_SWORD = 10;
 const int PIN_LEDS_GEMS = 8;
-const int NUM_PIXELS_GEMS = 4;
 const float MIN_BATTERY_VOLTAGE = 3.0;
 
-const int SWORD_TIP_LED_START = 60;   // Number of LEDs along the strand where the rolled-back segments starts.
-const int SWORD_TIP_LED_END = 150;    // Index of final LED in the strip.
-const int SWORD_TIP_HALF_N_LEDS = 45; // Number of LEDs on one side of the rolled-back segment.
-Adafruit_NeoPixel pixels_gems = Adafruit_NeoPixel(NUM_PIXELS_GEMS, PIN_LEDS_GEMS, NEO_GRB);
-Adafruit_NeoPixel pixels_sword = Adafruit_NeoPixel(SWORD_TIP_LED_END, PIN_LEDS_SWORD, NEO_GRB);
+Adafruit_NeoPixel pixels_gems = Adafruit_NeoPixel(VenatLayout::Strip2::NUM_PIXELS, PIN_LEDS_GEMS, NEO_GRB);
+Adafruit_NeoPixel pixels_sword = Adafruit_NeoPixel(VenatLayout::Strip1::NUM_PIXELS, PIN_LEDS_SWORD, NEO_GRB);
 
-class SwordLEDDriver : public PropLEDDriver
-{
-public:
-  /*
-   Sets the i^th pixel along the sword blade to the given color.
-   This function applies color corrections, handles the symmetric
-   LED strips at the tip of the sword, and dims the last few pixels
-   to not make the unlit tip look too relatively dim.
-  */
-  inline void setPixels1Color(int i, uint8_t r, uint8_t g, uint8_t b) override
-  {
-    if (i < SWORD_TIP_LED_START)
-    {
-      b *= 0.9;
-      m_pixels_1->setPixelColor(i, r, g, b);
-    }
-    else if (i >= SWORD_TIP_LED_START && i <= SWORD_TIP_LED_START + SWORD_TIP_HALF_N_LEDS)
-    {
-      // Apply color-correction for tip strip, and command symmetrically.
-      // Current correction is to just slightly bump the blue.
-      r *= 0.9;
-      m_pixels_1->setPixelColor(i, r, g, b);
-      m_pixels_1->setPixelColor(SWORD_TIP_LED_END - (i - SWORD_TIP_LED_START), r, g, b);
-    }
-    // Ignores pixels above halfway up the tip.
-  }
-};
+// Each strip goes out on its own PWM peripheral while the next frame renders.
+AsyncStripOutput<VenatLayout::Strip1> output_sword(pixels_sword, 2);
+AsyncStripOutput<VenatLayout::Strip2> output_gems(pixels_gems, 3);
 
-SwordLEDDriver sword_led_driver;
-StatusLEDManager status_led_manager(LED_BUILTIN);
+PropLEDDriver<VenatLayout> sword_led_driver;
+// The XIAO's LED_BUILTIN is lit by driving the pin low.
+StatusLEDManager status_led_manager(LED_BUILTIN, true);
+// Battery divider: 9910 ohms to 3V3, 9990 ohms to ground.
+BatteryMonitor battery_monitor(0, 9910.0, 9990.0, MIN_BATTERY_VOLTAGE);
 PropBLEManager prop_ble_manager;
+TaskScheduler scheduler;
+const float RENDER_FPS = 60;
+// Once switched off and dark, the render task only checks for being
+// switched back on.
+const float IDLE_RENDER_FPS = 10;
+int render_task_id = -1;
+int setup_task_id = -1;
+// setup_task retries once a second at first, backing off to this.
+const unsigned long SETUP_RETRY_MAX_US = 30000000;
+// Set once each has come up; until then setup_task retries it.
+bool leds_ready = false;
+bool ble_ready = false;
+// Estimated LED draw is held under this, for the pack and regulator; see
+// CurrentLimiter.h.
+const unsigned long LED_CURRENT_BUDGET_MA = 2000;
 
-bool setup_leds()
-{
-  pixels_sword.begin();
-  pixels_gems.begin();
-  sword_led_driver.register_strips(&pixels_sword, &pixels_gems);
-  return true;
-}
-
-bool setup_ble()
+// What the LEDs show from the first frame, before any central connects.
+void set_startup_control()
 {
   prop_ble_manager.led_enabled = true;
   // Start soft blue
@@ -95,7 +80,18 @@ bool setup_ble()
   prop_ble_manager.led_rgb_setting_2[1] = 20;
   prop_ble_manager.led_rgb_setting_2[2] = 30;
   prop_ble_manager.control_mode = ControlMode::DirectRGBPulsing;
+}
 
+bool setup_leds()
+{
+  pixels_sword.begin();
+  pixels_gems.begin();
+  return output_sword.begin() && output_gems.begin() &&
+         sword_led_driver.register_strips(&pixels_sword, &pixels_gems, &output_sword, &output_gems);
+}
+
+bool setup_ble()
+{
   if (!prop_ble_manager.setup("Venat-Sword"))
   {
     Serial.println("starting Bluetooth® Low Energy module failed!");
@@ -104,83 +100,160 @@ bool setup_ble()
   return true;
 }
 
-void setup()
+// Retries whatever failed to come up while everything else runs. The status
+// LED shows what's still missing.
+//
+// BLE.begin() blocks until the radio is up or has failed, and no other task
+// runs meanwhile: the LEDs hold their last frame for as long as it takes.
+// So each BLE failure doubles the wait before the next try, up to
+// SETUP_RETRY_MAX_US, and a radio that keeps failing slowly stalls the
+// render less and less often.
+void setup_task()
 {
-  Serial.begin(9600);
-  // Prep for battery voltage reading.
-  analogReadResolution(12);
-  status_led_manager.setup();
-
-  // Flip LED 3 times if failed to setup LEDs.
-  while (!setup_leds())
+  if (!leds_ready && !(leds_ready = setup_leds()))
   {
     Serial.println("Failed to setup LEDs.");
-    status_led_manager.flip_time_ms = 100;
-    unsigned long start_t = millis();
-    while (millis() - start_t < 1000)
-    {
-      status_led_manager.update();
-    }
-    delay(1000);
   }
-
-  // Flip LED 5 times if failed to setup BLE.
-  while (!setup_ble())
+  if (!ble_ready && !(ble_ready = setup_ble()))
   {
     Serial.println("Failed to setup BLE.");
-    status_led_manager.flip_time_ms = 250;
-    unsigned long start_t = millis();
-    while (millis() - start_t < 2000)
-    {
-      status_led_manager.update();
-    }
-    delay(1000);
+    scheduler.set_period(setup_task_id, min(2 * scheduler.task(setup_task_id).period_us, SETUP_RETRY_MAX_US));
   }
 }
 
-void loop()
+void ble_task()
 {
-  double t = ((double)millis()) / 1000.;
-
-  // Read the battery state and prepare it for publish.
-  // The battery is in the middle of a voltage divider, so multiply
-  // the read voltage accordingly:
-  //   read voltage = bat_voltage * (TO_GND)/(TO_GND + TO_HOT)
-  const float OHMS_TO_3V3 = 9910.0;
-  const float OHMS_TO_GND = 9990.0;
-  float read_voltage = 3.3 * ((float)analogRead(0)) / 4096.;
-  float battery_voltage = read_voltage * (OHMS_TO_3V3 + OHMS_TO_GND) / (OHMS_TO_GND);
-  bool battery_dead = battery_voltage < MIN_BATTERY_VOLTAGE;
-  if (battery_dead)
+  if (!ble_ready)
   {
-    prop_ble_manager.update(true, battery_voltage);
+    return;
   }
-  else
+  prop_ble_manager.update(battery_monitor.is_dead());
+  if (prop_ble_manager.effect_program_uploaded() &&
+      !sword_led_driver.load_program(prop_ble_manager.effect_program, prop_ble_manager.effect_program_length))
+  {
+    Serial.println("Rejected invalid effect program.");
+  }
+}
+
+void battery_task()
+{
+  battery_monitor.update();
+  if (ble_ready && battery_monitor.should_publish())
   {
-    prop_ble_manager.update(false, battery_voltage);
+    prop_ble_manager.publish_battery_voltage(battery_monitor.voltage());
   }
+}
 
+void render_task()
+{
+  // Local time until a central sends its clock; see ClockSync.h.
+  double t = prop_ble_manager.clock_sync.now_seconds();
   sword_led_driver.update(
       {t,
        prop_ble_manager.led_enabled,
        {prop_ble_manager.led_rgb_setting_1[0], prop_ble_manager.led_rgb_setting_1[1], prop_ble_manager.led_rgb_setting_1[2]},
        prop_ble_manager.control_mode});
+  scheduler.set_period(render_task_id, 1000000 / (sword_led_driver.idle() ? IDLE_RENDER_FPS : RENDER_FPS));
+}
 
-  // Flip LED to show state.
-  // 5hz: battery dead
-  // 2hz: leds on
-  // 1hz: leds off, battery fine.
-  if (battery_dead)
+void stats_task()
+{
+  if (!ble_ready)
+  {
+    return;
+  }
+  prop_ble_manager.publish_frame_rate(sword_led_driver.m_governor.achieved_fps());
+  prop_ble_manager.publish_current_draw(sword_led_driver.m_current_limiter.estimated_ma());
+  prop_ble_manager.publish_keyframe_stats();
+  prop_ble_manager.publish_profile();
+}
+
+// Serial commands: 'p' prints the stage profile, 't' the task scheduler's
+// stats (overruns and worst lateness per task), 'r' resets both.
+void serial_task()
+{
+  while (Serial.available() > 0)
+  {
+    int command = Serial.read();
+    if (command == 'p')
+    {
+      StageProfiler::instance().dump(Serial);
+    }
+    else if (command == 't')
+    {
+      scheduler.dump(Serial);
+    }
+    else if (command == 'r')
+    {
+      StageProfiler::instance().reset();
+      scheduler.reset_stats();
+    }
+  }
+}
+
+void status_led_task()
+{
+  // 3 flashes: LEDs failed to set up. 5 flashes: BLE failed to set up.
+  // 5 Hz: battery dead. 2 Hz: LEDs on.
+  // LEDs off: 1 to 4 flashes for the battery's charge.
+  if (!leds_ready)
   {
-    status_led_manager.flip_time_ms = 100;
+    status_led_manager.blink_code(3);
+  }
+  else if (!ble_ready)
+  {
+    status_led_manager.blink_code(5);
+  }
+  else if (battery_monitor.is_dead())
+  {
+    status_led_manager.blink(100);
   }
   else if (prop_ble_manager.led_enabled)
   {
-    status_led_manager.flip_time_ms = 250;
+    status_led_manager.blink(250);
   }
   else
   {
-    status_led_manager.flip_time_ms = 500;
+    status_led_manager.blink_code(battery_monitor.charge_level(4));
   }
   status_led_manager.update();
-}
\ No newline at end of file
+}
+
+void setup()
+{
+  Serial.begin(9600);
+  // Prep for battery voltage reading.
+  analogReadResolution(12);
+  battery_monitor.setup();
+  // The scheduler samples the battery at 1 Hz, so sample on every update
+  // and weight each sample more heavily than the 10 Hz default.
+  battery_monitor.sample_period_ms = 0;
+  battery_monitor.ema_alpha = 0.3;
+  status_led_manager.setup();
+
+  set_startup_control();
+  // LEDs first, so the first frame goes out before BLE has started (it's
+  // the slow part); setup_task brings up BLE and retries anything that
+  // failed.
+  leds_ready = setup_leds();
+
+  sword_led_driver.register_keyframes(&prop_ble_manager.keyframes);
+
+  // Most urgent first: tasks that come due together run in this order.
+  scheduler.add_task("ble", ble_task, 1000000 / 20);
+  sword_led_driver.m_current_limiter.budget_ma = LED_CURRENT_BUDGET_MA;
+  sword_led_driver.m_governor.target_fps = RENDER_FPS;
+  render_task_id = scheduler.add_task("render", render_task, 1000000 / RENDER_FPS);
+  scheduler.add_task("status_led", status_led_task, StatusLEDManager::STEP_MS * 1000);
+  scheduler.add_task("battery", battery_task, 1000000 / 1);
+  scheduler.add_task("stats", stats_task, 1000000 / 1);
+  scheduler.add_task("serial", serial_task, 1000000 / 10);
+  // Last, so the first frame goes out before BLE starts.
+  setup_task_id = scheduler.add_task("setup", setup_task, 1000000 / 1);
+}
+
+void loop()
+{
+  scheduler.update();
+  scheduler.sleep_until_due();
+}
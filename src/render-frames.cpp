@@ -0,0 +1,362 @@
+/**
+ *  Headless renderer: runs one prop's layout in one ControlMode on the
+ *  simulated clock and writes every frame to disk, so a change to the
+ *  effect math can be checked against frames rendered before it.
+ *
+ *    pio run -e render-frames
+ *    .pio/build/render-frames/program -- --prop venat --mode 2 --out golden.bin
+ *    (change things)
+ *    .pio/build/render-frames/program -- --prop venat --mode 2 --compare golden.bin --tolerance 1
+ *
+ *  Every prop and mode is also checked against the checked-in golden frames
+ *  by pio test -e native-venat -f test_golden_frames.
+ *
+ *  Options (after the harness's "--"):
+ *    --prop NAME      venat, hermes, hyth, hyth-arrow or emet (default venat).
+ *    --mode N         ControlMode 0..4 (default 2). Keyframes (5) needs a
+ *                     stream; see replay-keyframes.
+ *    --rgb RRGGBB     Input color, hex (default 2850ff).
+ *    --seconds S      Simulated seconds to render (default 5).
+ *    --fps F          Frame rate (default 60).
+ *    --program FILE   Effect program as hex, e.g. from effect-compiler, for
+ *                     mode 4.
+ *    --out FILE       Writes the frames; .ppm gets a strip image (one row per
+ *                     frame, W folded into RGB), anything else the binary
+ *                     format in GoldenFrames.h.
+ *    --compare FILE   Compares against frames in the binary format. Exits
+ *                     with 1 if any byte differs by more than --tolerance
+ *                     (default 0).
+ *    --budget-ma MA   LED current budget, as the prop's main sets it
+ *                     (default 0, unlimited).
+ *    --update-golden  Renders every prop in every mode but Keyframes with
+ *                     the golden settings into the golden frames that
+ *                     test_golden_frames checks (see GoldenFrames.h), and
+ *                     ignores the other options. Run it from the project
+ *                     root after a change that's meant to change the
+ *                     output, and check the new frames in with it.
+ *
+ *  Prints one CSV row on stdout: host render throughput (update() only, not
+ *  the capture or file writes), and the peak estimated LED current draw
+ *  after limiting, with the number of frames the limiter scaled down.
+ */
+
+
+#include <Adafruit_NeoPixel.h>
+#include "PropLayouts.h"
+#include "GoldenFrames.h"
+
+typedef struct Options
+{
+  const char *prop;
+  int mode;
+  uint8_t rgb[3];
+  double seconds;
+  double fps;
+  const char *program_path;
+  const char *out_path;
+  const char *compare_path;
+  int tolerance;
+  unsigned long budget_ma;
+  bool update_golden;
+} Options;
+
+Options options = {"venat", ControlMode::PartyModeFlowing, {0x28, 0x50, 0xff}, 5., 60., nullptr, nullptr, nullptr, 0, 0, false};
+
+const char *const PROPS[] = {"venat", "hermes", "hyth", "hyth-arrow", "emet"};
+
+void fail(const char *message, const char *detail = "")
+{
+  fprintf(stderr, "error: %s%s\n", message, detail);
+  exit(2);
+}
+
+bool parse_options()
+{
+  int argc = NativeSim::argc();
+  char **argv = NativeSim::argv();
+  for (int i = 0; i < argc; i++)
+  {
+    bool has_value = i + 1 < argc;
+    if (!strcmp(argv[i], "--prop") && has_value)
+    {
+      options.prop = argv[++i];
+    }
+    else if (!strcmp(argv[i], "--mode") && has_value)
+    {
+      options.mode = atoi(argv[++i]);
+    }
+    else if (!strcmp(argv[i], "--rgb") && has_value)
+    {
+      unsigned long rgb = strtoul(argv[++i], nullptr, 16);
+      options.rgb[0] = rgb >> 16;
+      options.rgb[1] = rgb >> 8;
+      options.rgb[2] = rgb;
+    }
+    else if (!strcmp(argv[i], "--seconds") && has_value)
+    {
+      options.seconds = atof(argv[++i]);
+    }
+    else if (!strcmp(argv[i], "--fps") && has_value)
+    {
+      options.fps = atof(argv[++i]);
+    }
+    else if (!strcmp(argv[i], "--program") && has_value)
+    {
+      options.program_path = argv[++i];
+    }
+    else if (!strcmp(argv[i], "--out") && has_value)
+    {
+      options.out_path = argv[++i];
+    }
+    else if (!strcmp(argv[i], "--compare") && has_value)
+    {
+      options.compare_path = argv[++i];
+    }
+    else if (!strcmp(argv[i], "--tolerance") && has_value)
+    {
+      options.tolerance = atoi(argv[++i]);
+    }
+    else if (!strcmp(argv[i], "--budget-ma") && has_value)
+    {
+      options.budget_ma = strtoul(argv[++i], nullptr, 10);
+    }
+    else if (!strcmp(argv[i], "--update-golden"))
+    {
+      options.update_golden = true;
+    }
+    else
+    {
+      fprintf(stderr, "Unknown option %s\n", argv[i]);
+      return false;
+    }
+  }
+  if (options.mode < ControlMode::DirectRGB || options.mode > ControlMode::Program)
+  {
+    fprintf(stderr, "--mode must be 0..%d\n", (int)ControlMode::Program);
+    return false;
+  }
+  if (options.fps <= 0 || options.seconds <= 0)
+  {
+    fprintf(stderr, "--fps and --seconds must be positive\n");
+    return false;
+  }
+  return true;
+}
+
+// Appends one strip's frame to a PPM row as RGB, with W added on top.
+template <typename Strip>
+void append_ppm_row(const uint8_t *pixels, uint8_t *row)
+{
+  for (int i = 0; i < Strip::NUM_PIXELS; i++)
+  {
+    const uint8_t *p = pixels + i * Strip::BYTES_PER_PIXEL;
+    int w = Strip::BYTES_PER_PIXEL == 4 ? p[Strip::W_OFFSET] : 0;
+    row[3 * i] = min(p[Strip::R_OFFSET] + w, 255);
+    row[3 * i + 1] = min(p[Strip::G_OFFSET] + w, 255);
+    row[3 * i + 2] = min(p[Strip::B_OFFSET] + w, 255);
+  }
+}
+
+template <typename Layout>
+bool render(const char *prop)
+{
+  typedef GoldenFrames::Renderer<Layout> Renderer;
+  typedef typename Renderer::Strip1 Strip1;
+  typedef typename Renderer::Strip2 Strip2;
+  const int row_bytes = 3 * (Strip1::NUM_PIXELS + Strip2::NUM_PIXELS);
+
+  uint8_t program[EffectProgram::MAX_SIZE];
+  int program_length = 0;
+  if (options.program_path)
+  {
+    program_length = GoldenFrames::read_program_hex(options.program_path, program);
+    if (program_length < 0)
+    {
+      fail("bad program hex in ", options.program_path);
+    }
+  }
+  Renderer renderer({options.mode, {options.rgb[0], options.rgb[1], options.rgb[2]}, options.seconds, options.fps,
+                     options.budget_ma, options.program_path ? program : nullptr, program_length});
+  if (!renderer.program_ok())
+  {
+    fail("invalid effect program in ", options.program_path);
+  }
+  uint32_t frames = renderer.num_frames();
+  uint8_t header[GoldenFrames::HEADER_SIZE];
+  renderer.write_header(header);
+
+  FILE *out = nullptr;
+  bool ppm = false;
+  if (options.out_path)
+  {
+    out = fopen(options.out_path, "wb");
+    if (!out)
+    {
+      fail("can't write ", options.out_path);
+    }
+    const char *extension = strrchr(options.out_path, '.');
+    ppm = extension && !strcmp(extension, ".ppm");
+    if (ppm)
+    {
+      fprintf(out, "P6\n%d %u\n255\n", row_bytes / 3, (unsigned)frames);
+    }
+    else
+    {
+      fwrite(header, 1, GoldenFrames::HEADER_SIZE, out);
+    }
+  }
+
+  GoldenFrames::Comparer comparer;
+  if (options.compare_path && !comparer.open(options.compare_path, header, options.tolerance))
+  {
+    fail("can't read, or different format or strip geometry in ", options.compare_path);
+  }
+
+  std::vector<uint8_t> row(row_bytes);
+  while (renderer.next())
+  {
+    const uint8_t *frame = renderer.frame();
+    if (out && ppm)
+    {
+      append_ppm_row<Strip1>(frame, row.data());
+      append_ppm_row<Strip2>(frame + Strip1::NUM_BYTES, row.data() + 3 * Strip1::NUM_PIXELS);
+      fwrite(row.data(), 1, row_bytes, out);
+    }
+    else if (out)
+    {
+      fwrite(frame, 1, Renderer::FRAME_BYTES, out);
+    }
+    if (options.compare_path)
+    {
+      comparer.add(frame, Renderer::FRAME_BYTES);
+    }
+  }
+  if (out)
+  {
+    fclose(out);
+  }
+
+  printf("prop,mode,frames,pixels,ns_per_frame,ns_per_pixel,frames_per_s,peak_ma,limited_frames\n");
+  int pixels = Strip1::NUM_PIXELS + Strip2::NUM_PIXELS;
+  double update_ns = renderer.update_ns();
+  printf("%s,%d,%u,%d,%.1f,%.3f,%.1f,%.0f,%lu\n", prop, options.mode, (unsigned)frames, pixels,
+         update_ns / frames, update_ns / frames / pixels, frames * 1e9 / update_ns, renderer.peak_ma(),
+         renderer.driver.m_current_limiter.limited_frames());
+
+  if (!options.compare_path)
+  {
+    return true;
+  }
+  const GoldenFrames::Comparison &result = comparer.result();
+  if (result.golden_frames != result.frames)
+  {
+    fprintf(stderr, "compare: %u frames rendered, %u in %s\n", (unsigned)result.frames,
+            (unsigned)result.golden_frames, options.compare_path);
+  }
+  fprintf(stderr, "compare: max difference %d, %u frames over tolerance %d", result.max_diff,
+          (unsigned)result.frames_over, options.tolerance);
+  if (result.first_over >= 0)
+  {
+    fprintf(stderr, " (first at frame %ld, t = %.3f s)", result.first_over, result.first_over / options.fps);
+  }
+  fprintf(stderr, ": %s\n", result.ok() ? "ok" : "FAIL");
+  return result.ok();
+}
+
+// Writes one prop's golden frames, one file per mode.
+template <typename Layout>
+bool update_golden(const char *prop)
+{
+  uint8_t program[EffectProgram::MAX_SIZE];
+  int program_length = GoldenFrames::read_program_hex(GoldenFrames::GOLDEN_PROGRAM_PATH, program);
+  if (program_length < 0)
+  {
+    fail("can't read program hex in ", GoldenFrames::GOLDEN_PROGRAM_PATH);
+  }
+  for (int mode = 0; mode < GoldenFrames::NUM_GOLDEN_MODES; mode++)
+  {
+    GoldenFrames::Renderer<Layout> renderer(GoldenFrames::golden_settings(mode, program, program_length));
+    if (!renderer.program_ok())
+    {
+      fail("invalid effect program in ", GoldenFrames::GOLDEN_PROGRAM_PATH);
+    }
+    char path[64];
+    GoldenFrames::golden_path(path, prop, mode);
+    FILE *out = fopen(path, "wb");
+    if (!out)
+    {
+      fail("can't write ", path);
+    }
+    uint8_t header[GoldenFrames::HEADER_SIZE];
+    renderer.write_header(header);
+    fwrite(header, 1, GoldenFrames::HEADER_SIZE, out);
+    while (renderer.next())
+    {
+      fwrite(renderer.frame(), 1, GoldenFrames::Renderer<Layout>::FRAME_BYTES, out);
+    }
+    fclose(out);
+    fprintf(stderr, "wrote %s\n", path);
+  }
+  return true;
+}
+
+template <typename Layout>
+bool run(const char *prop)
+{
+  return options.update_golden ? update_golden<Layout>(prop) : render<Layout>(prop);
+}
+
+bool run_prop(const char *prop)
+{
+  if (!strcmp(prop, "venat"))
+  {
+    return run<VenatLayout>(prop);
+  }
+  else if (!strcmp(prop, "hermes"))
+  {
+    return run<HermesLayout>(prop);
+  }
+  else if (!strcmp(prop, "hyth"))
+  {
+    return run<HythLayout>(prop);
+  }
+  else if (!strcmp(prop, "hyth-arrow"))
+  {
+    return run<HythArrowLayout>(prop);
+  }
+  else if (!strcmp(prop, "emet"))
+  {
+    return run<EmetLayout>(prop);
+  }
+  fail("unknown prop ", prop);
+  return false;
+}
+
+void setup()
+{
+  if (!parse_options())
+  {
+    exit(2);
+  }
+  bool ok = true;
+  if (options.update_golden)
+  {
+    for (const char *prop : PROPS)
+    {
+      ok = run_prop(prop) && ok;
+    }
+  }
+  else
+  {
+    ok = run_prop(options.prop);
+  }
+  if (!ok)
+  {
+    exit(1);
+  }
+  NativeSim::stop();
+}
+
+void loop()
+{
+}
@@ -0,0 +1,161 @@
+/**
+ *  Host replay of a keyframe stream through PropBLEManager and
+ *  PropLEDDriver, on the simulated clock (so a long show replays in well
+ *  under a second).
+ *
+ *  Reads keyframes on stdin, one per line ('#' starts a comment):
+ *
+ *    time_ms mode r g b [off] [end]
+ *
+ *  and streams them over the fake BLE link the way the app would: a write
+ *  of up to MAX_KEYFRAMES_PER_WRITE keyframes every connection interval,
+ *  staying SEND_AHEAD_MS ahead of playback. It does this twice, once with a
+ *  clean link and once with the link stalling for STALL_MS mid-show, and
+ *  prints what logical pixel 0 shows every frame as CSV, with the stream's
+ *  counters on stderr:
+ *
+ *    pio run -e replay-keyframes
+ *    .pio/build/replay-keyframes/program < show.txt > replay.csv
+ */
+
+#include <Adafruit_NeoPixel.h>
+#include "PropLEDDriver.h"
+
+const unsigned long CONNECTION_INTERVAL_MS = 30;
+const unsigned long SEND_AHEAD_MS = 1000;
+const unsigned long STALL_MS = 1500;
+const unsigned long FRAME_US = 16667;
+const unsigned long BLE_PERIOD_US = 50000;
+const int MAX_KEYFRAMES = 4096;
+
+typedef PropLayout<StripSpec<30, NEO_GRB>> ReplayLayout;
+
+PropBLEManager prop_ble_manager;
+PropLEDDriver<ReplayLayout> prop_led_driver;
+Adafruit_NeoPixel pixels(ReplayLayout::Strip1::NUM_PIXELS, 10, NEO_GRB);
+
+Keyframe keyframes[MAX_KEYFRAMES];
+int num_keyframes = 0;
+
+int read_keyframes()
+{
+  char line[256];
+  int n = 0;
+  while (n < MAX_KEYFRAMES && fgets(line, sizeof(line), stdin))
+  {
+    char *comment = strchr(line, '#');
+    if (comment)
+    {
+      *comment = 0;
+    }
+    unsigned long time_ms;
+    int mode, r, g, b, consumed;
+    if (sscanf(line, "%lu %d %d %d %d%n", &time_ms, &mode, &r, &g, &b, &consumed) != 5)
+    {
+      continue;
+    }
+    uint8_t flags = strstr(line + consumed, "off") ? 0 : KEYFRAME_ON;
+    if (strstr(line + consumed, "end"))
+    {
+      flags |= KEYFRAME_END;
+    }
+    keyframes[n++] = {(uint32_t)time_ms, flags, (uint8_t)mode, (uint8_t)r, (uint8_t)g, (uint8_t)b};
+  }
+  return n;
+}
+
+void pack_keyframe(const Keyframe &keyframe, uint8_t *p)
+{
+  for (int i = 0; i < 4; i++)
+  {
+    p[i] = (keyframe.time_ms >> (8 * i)) & 0xFF;
+  }
+  p[4] = keyframe.flags;
+  p[5] = keyframe.mode;
+  p[6] = keyframe.r;
+  p[7] = keyframe.g;
+  p[8] = keyframe.b;
+}
+
+void replay(const char *scenario, bool stall)
+{
+  prop_ble_manager.keyframes = KeyframeStream();
+  uint64_t start_us = NativeSim::time_us();
+  uint32_t show_end_ms = keyframes[num_keyframes - 1].time_ms;
+  uint32_t stall_start_ms = show_end_ms / 2;
+  uint64_t next_send_us = start_us, next_ble_us = start_us, next_frame_us = start_us;
+  int next_keyframe = 0;
+
+  // Run until the show has played out, plus the lead and a little slack.
+  uint64_t end_us = start_us + (uint64_t)(show_end_ms + prop_ble_manager.keyframes.lead_ms + 500) * 1000;
+  while (NativeSim::time_us() < end_us)
+  {
+    uint64_t now_us = NativeSim::time_us();
+    unsigned long elapsed_ms = (now_us - start_us) / 1000;
+    if (now_us >= next_send_us)
+    {
+      next_send_us += CONNECTION_INTERVAL_MS * 1000;
+      bool stalled = stall && elapsed_ms >= stall_start_ms && elapsed_ms < stall_start_ms + STALL_MS;
+      uint8_t packed[MAX_KEYFRAMES_PER_WRITE * KEYFRAME_SIZE];
+      int n = 0;
+      while (!stalled && n < MAX_KEYFRAMES_PER_WRITE && next_keyframe < num_keyframes &&
+             keyframes[next_keyframe].time_ms <= elapsed_ms + SEND_AHEAD_MS)
+      {
+        pack_keyframe(keyframes[next_keyframe++], packed + n * KEYFRAME_SIZE);
+        n++;
+      }
+      if (n > 0)
+      {
+        prop_ble_manager.ble_keyframe_characteristic.sim_central_write(packed, n * KEYFRAME_SIZE);
+      }
+    }
+    if (now_us >= next_ble_us)
+    {
+      next_ble_us += BLE_PERIOD_US;
+      prop_ble_manager.update(false);
+    }
+    if (now_us >= next_frame_us)
+    {
+      next_frame_us += FRAME_US;
+      prop_led_driver.update({now_us / 1e6, true, {0, 0, 0}, ControlMode::Keyframes});
+      PropLEDDriverBase::Color16 c = prop_led_driver.m_logical[0];
+      printf("%s,%lu,%d,%d,%d,%d\n", scenario, elapsed_ms, c.r >> 8, c.g >> 8, c.b >> 8, prop_ble_manager.keyframes.size());
+      // show() advances the clock itself.
+      continue;
+    }
+    NativeSim::advance_us(1000);
+  }
+
+  const KeyframeStream &stream = prop_ble_manager.keyframes;
+  fprintf(stderr, "%s: sent %d, received %lu, overruns %lu, underruns %lu\n",
+          scenario, next_keyframe, stream.received, stream.overruns, stream.underruns);
+}
+
+void setup()
+{
+  num_keyframes = read_keyframes();
+  if (num_keyframes == 0)
+  {
+    fprintf(stderr, "No keyframes on stdin.\n");
+    exit(1);
+  }
+
+  pixels.begin();
+  prop_led_driver.register_strips(&pixels, nullptr);
+  prop_led_driver.register_keyframes(&prop_ble_manager.keyframes);
+  prop_ble_manager.setup("Replay");
+  BLE.sim_connect_central();
+  // Switch on and let the transition finish so every frame is fully
+  // rendered.
+  prop_led_driver.update({0., true, {0, 0, 0}, ControlMode::Keyframes});
+  NativeSim::advance_us(10000000);
+
+  printf("scenario,t_ms,r,g,b,buffered\n");
+  replay("clean", false);
+  replay("stall", true);
+  NativeSim::stop();
+}
+
+void loop()
+{
+}
@@ -0,0 +1,116 @@
+/**
+ *  Host simulation of ClockSync across several props with skewed crystals.
+ *
+ *  The phone writes its time to every prop once per SYNC_PERIOD_US. Each
+ *  write arrives after a random radio delay of up to one connection
+ *  interval, and is timestamped by the prop at its next BLE poll (the 20 Hz
+ *  BLE task), on the prop's own clock. Every second, prints each prop's
+ *  effect clock error against the phone, with and without sync, as CSV:
+ *
+ *    pio run -e sim-clock-sync && .pio/build/sim-clock-sync/program > sync.csv
+ *
+ *  The spread between props is what shows up as phase error between
+ *  them; with sync it should settle within a few ms, without it grows by
+ *  the skew difference (here up to 140 ppm, ~8 ms a minute).
+ */
+
+#include <random>
+#include <Arduino.h>
+#include "ClockSync.h"
+
+const double SIM_SECONDS = 3600;
+const uint64_t SYNC_PERIOD_US = 1000000;
+const uint64_t CONNECTION_INTERVAL_US = 30000;
+const uint64_t BLE_POLL_PERIOD_US = 50000;
+
+typedef struct SimProp
+{
+  const char *name;
+  double skew_ppm;
+  double boot_us; // Reference time at which the prop's clock read 0.
+  ClockSync sync;
+  uint64_t next_sync_us;
+} SimProp;
+
+// Local clock of a prop at a reference time.
+uint64_t local_us(const SimProp &prop, double reference_us)
+{
+  return (uint64_t)((reference_us - prop.boot_us) * (1. + prop.skew_ppm * 1e-6));
+}
+
+void setup()
+{
+  SimProp props[] = {
+      {"hyth", 40, 1.2e6, ClockSync(), 0},
+      {"hyth-arrow", -60, 3.7e6, ClockSync(), 0},
+      {"emet", 80, 0.4e6, ClockSync(), 0},
+      {"hermes", -25, 5.1e6, ClockSync(), 0},
+  };
+  const int n_props = sizeof(props) / sizeof(props[0]);
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<double> radio_delay(0., CONNECTION_INTERVAL_US);
+  std::uniform_real_distribution<double> dither(0., BLE_POLL_PERIOD_US);
+
+  // The phone starts syncing once every prop has booted.
+  const double start_us = 6e6;
+  for (int p = 0; p < n_props; p++)
+  {
+    props[p].next_sync_us = start_us + p * 200000;
+  }
+
+  printf("time_s,prop,skew_ppm,synced_error_ms,unsynced_error_ms,rate_ppm\n");
+  double worst_synced_spread_ms = 0;
+  double unsynced_spread_ms = 0;
+  for (double t_us = start_us; t_us < start_us + SIM_SECONDS * 1e6; t_us += 1000)
+  {
+    for (int p = 0; p < n_props; p++)
+    {
+      SimProp &prop = props[p];
+      if (t_us < prop.next_sync_us)
+      {
+        continue;
+      }
+      double sent_us = prop.next_sync_us;
+      // Dithered, so the prop's poll phase doesn't bias every sample the
+      // same way.
+      prop.next_sync_us += SYNC_PERIOD_US + (uint64_t)dither(rng);
+      // Arrives, then waits for the prop's next poll on its own clock.
+      double local_arrival = local_us(prop, sent_us + radio_delay(rng));
+      double local_handled = ceil(local_arrival / BLE_POLL_PERIOD_US) * BLE_POLL_PERIOD_US;
+      prop.sync.add_sample((uint64_t)sent_us, (uint64_t)local_handled);
+    }
+
+    // Once a second, compare every prop's effect clock with the phone's.
+    if (fmod(t_us - start_us, 1e6) == 0)
+    {
+      double lo = 1e18, hi = -1e18, unsynced_lo = 1e18, unsynced_hi = -1e18;
+      for (int p = 0; p < n_props; p++)
+      {
+        SimProp &prop = props[p];
+        double synced_error_ms = (prop.sync.reference_us(local_us(prop, t_us)) - t_us) / 1000.;
+        // Unsynced, effects run on local time; only the drift since the
+        // phone started is meaningful.
+        double unsynced_error_ms = ((double)local_us(prop, t_us) - local_us(prop, start_us) - (t_us - start_us)) / 1000.;
+        printf("%.0f,%s,%.0f,%.3f,%.3f,%.1f\n", (t_us - start_us) / 1e6, prop.name, prop.skew_ppm,
+               synced_error_ms, unsynced_error_ms, prop.sync.rate_ppm());
+        lo = min(lo, synced_error_ms);
+        hi = max(hi, synced_error_ms);
+        unsynced_lo = min(unsynced_lo, unsynced_error_ms);
+        unsynced_hi = max(unsynced_hi, unsynced_error_ms);
+      }
+      // Give the loop a minute to pull in from the first sample.
+      if (t_us - start_us >= 60e6)
+      {
+        worst_synced_spread_ms = max(worst_synced_spread_ms, hi - lo);
+      }
+      unsynced_spread_ms = unsynced_hi - unsynced_lo;
+    }
+  }
+  fprintf(stderr, "spread between props after %.0f s: %.1f ms unsynced; worst %.1f ms synced (after the first minute)\n",
+          SIM_SECONDS, unsynced_spread_ms, worst_synced_spread_ms);
+  NativeSim::stop();
+}
+
+void loop()
+{
+}
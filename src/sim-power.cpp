@@ -0,0 +1,233 @@
+/**
+ *  Host simulation of a prop's power states: how much of the time the CPU
+ *  is awake, and how often the radio advertises, with the LEDs on, with
+ *  them switched off, and with them off and no phone around.
+ *
+ *  Runs the Venat sword's task set (BLE 20 Hz, render 60 Hz, status LED,
+ *  battery, stats and serial) against the real driver, BLE manager and
+ *  scheduler, once the way loop() used to run it (spinning between tasks,
+ *  rendering every frame while dark) and once sleeping until the next task
+ *  is due, with the render task dropping to IDLE_RENDER_FPS once the
+ *  driver is idle. Prints CSV:
+ *
+ *    pio run -e sim-power && .pio/build/sim-power/program -- --seconds 300 > power.csv
+ *
+ *  The host clock only moves when told to, so each pass of the loop moves
+ *  it on by an estimate of its CPU time: the TASK_COSTS of whatever ran
+ *  (rough nRF52840 figures; the stage profiler gives real ones), plus
+ *  WAKE_US. That's the time counted as awake; a spinning loop is awake all
+ *  the time.
+ */
+
+#include <string.h>
+#include <Adafruit_NeoPixel.h>
+#include "PropLayouts.h"
+#include "PropBLEManager.h"
+#include "TaskScheduler.h"
+
+const float RENDER_FPS = 60;
+const float IDLE_RENDER_FPS = 10;
+// How far the clock moves per pass of a loop that doesn't sleep, on top of
+// whatever ran.
+const uint32_t SPIN_STEP_US = 100;
+const uint32_t WAKE_US = 10;
+
+typedef struct TaskCost
+{
+  const char *name;
+  uint32_t run_us;
+} TaskCost;
+
+// A render that produces a frame costs RENDER_FRAME_US; one that finds the
+// driver idle costs the "render" entry.
+const uint32_t RENDER_FRAME_US = 1500;
+const TaskCost TASK_COSTS[] = {
+    {"ble", 40},
+    {"render", 5},
+    {"status_led", 5},
+    {"battery", 50},
+    {"stats", 200},
+    {"serial", 5},
+};
+
+typedef struct Scenario
+{
+  const char *name;
+  bool led_enabled;
+  // The phone switches the LEDs, then stays connected or leaves.
+  bool stays_connected;
+} Scenario;
+
+const Scenario SCENARIOS[] = {
+    {"on_connected", true, true},
+    {"off_connected", false, true},
+    {"off_no_central", false, false},
+};
+
+Adafruit_NeoPixel pixels_sword(VenatLayout::Strip1::NUM_PIXELS, 10, NEO_GRB);
+Adafruit_NeoPixel pixels_gems(VenatLayout::Strip2::NUM_PIXELS, 8, NEO_GRB);
+AsyncStripOutput<VenatLayout::Strip1> output_sword(pixels_sword, 2);
+AsyncStripOutput<VenatLayout::Strip2> output_gems(pixels_gems, 3);
+PropBLEManager prop_ble_manager;
+
+// Fresh for every run.
+PropLEDDriver<VenatLayout> *g_driver = nullptr;
+TaskScheduler *g_scheduler = nullptr;
+int g_render_task_id = -1;
+bool g_low_power = false;
+
+void ble_task()
+{
+  prop_ble_manager.update(false);
+}
+
+void render_task()
+{
+  if (!g_low_power)
+  {
+    // As before the driver could idle: every frame rendered.
+    g_driver->m_idle = false;
+  }
+  g_driver->update({prop_ble_manager.clock_sync.now_seconds(),
+                    prop_ble_manager.led_enabled,
+                    {prop_ble_manager.led_rgb_setting_1[0], prop_ble_manager.led_rgb_setting_1[1],
+                     prop_ble_manager.led_rgb_setting_1[2]},
+                    prop_ble_manager.control_mode});
+  if (g_low_power)
+  {
+    g_scheduler->set_period(g_render_task_id, 1000000 / (g_driver->idle() ? IDLE_RENDER_FPS : RENDER_FPS));
+  }
+}
+
+// The other tasks only cost time here.
+void idle_task()
+{
+}
+
+uint32_t task_cost_us(const char *name)
+{
+  for (const TaskCost &cost : TASK_COSTS)
+  {
+    if (!strcmp(cost.name, name))
+    {
+      return cost.run_us;
+    }
+  }
+  return 0;
+}
+
+void run(const Scenario &scenario, bool low_power, double seconds)
+{
+  PropLEDDriver<VenatLayout> driver;
+  TaskScheduler scheduler;
+  g_driver = &driver;
+  g_scheduler = &scheduler;
+  g_low_power = low_power;
+  driver.register_strips(&pixels_sword, &pixels_gems, &output_sword, &output_gems);
+
+  // Start the same way every run: connected with the LEDs on, so the
+  // driver has something to fade out from.
+  BLE.sim_connect_central();
+  prop_ble_manager.led_enabled = true;
+  prop_ble_manager.ble_switch_characteristic.sim_central_write(scenario.led_enabled);
+  if (!scenario.stays_connected)
+  {
+    BLE.sim_disconnect_central();
+  }
+
+  scheduler.add_task("ble", ble_task, 1000000 / 20);
+  g_render_task_id = scheduler.add_task("render", render_task, 1000000 / RENDER_FPS);
+  scheduler.add_task("status_led", idle_task, 1000000 / 10);
+  scheduler.add_task("battery", idle_task, 1000000 / 1);
+  scheduler.add_task("stats", idle_task, 1000000 / 1);
+  scheduler.add_task("serial", idle_task, 1000000 / 10);
+
+  uint64_t start_us = NativeSim::time_us();
+  uint64_t end_us = start_us + (uint64_t)(seconds * 1e6);
+  uint64_t last_us = start_us;
+  unsigned long loops = 0;
+  unsigned long frames = 0;
+  double awake_us = 0;
+  double advertising_events = 0;
+  unsigned long runs[TaskScheduler::MAX_TASKS] = {};
+  while (NativeSim::time_us() < end_us)
+  {
+    uint64_t now = NativeSim::time_us();
+    if (BLE.sim_advertising())
+    {
+      advertising_events += (now - last_us) / (BLE.sim_advertising_interval() * 625.);
+    }
+    last_us = now;
+    scheduler.update();
+    loops++;
+
+    // Charge the pass its CPU time, which also moves the clock on.
+    uint32_t pass_us = WAKE_US;
+    for (int i = 0; i < scheduler.num_tasks(); i++)
+    {
+      const Task &task = scheduler.task(i);
+      pass_us += (task.runs - runs[i]) * task_cost_us(task.name);
+      runs[i] = task.runs;
+    }
+    pass_us += (driver.m_frame_stats.frames_rendered - frames) * (RENDER_FRAME_US - task_cost_us("render"));
+    frames = driver.m_frame_stats.frames_rendered;
+    NativeSim::advance_us(pass_us);
+    awake_us += pass_us;
+
+    if (low_power)
+    {
+      scheduler.sleep_until_due();
+    }
+    else
+    {
+      NativeSim::advance_us(SPIN_STEP_US);
+      awake_us += SPIN_STEP_US;
+    }
+  }
+
+  double elapsed_us = NativeSim::time_us() - start_us;
+  double awake_fraction = min(awake_us / elapsed_us, 1.);
+
+  printf("%s,%s,%.0f,%.4f,%.1f,%.1f,%.1f,%.0f,%.2f\n", scenario.name, low_power ? "sleep_idle" : "spin",
+         elapsed_us / 1e6, awake_fraction, loops / (elapsed_us / 1e6), frames / (elapsed_us / 1e6),
+         driver.m_frame_stats.frames_pushed / (elapsed_us / 1e6),
+         prop_ble_manager.current_advertising_interval() * 0.625, advertising_events / (elapsed_us / 1e6));
+}
+
+void setup()
+{
+  double seconds = 300;
+  int argc = NativeSim::argc();
+  char **argv = NativeSim::argv();
+  for (int i = 0; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "--seconds") && i + 1 < argc)
+    {
+      seconds = atof(argv[++i]);
+    }
+  }
+
+  pixels_sword.begin();
+  pixels_gems.begin();
+  output_sword.begin();
+  output_gems.begin();
+  prop_ble_manager.control_mode = ControlMode::DirectRGBPulsing;
+  for (int c = 0; c < 3; c++)
+  {
+    prop_ble_manager.led_rgb_setting_1[c] = 40;
+  }
+  prop_ble_manager.setup("Venat-Sword");
+
+  printf("scenario,loop,seconds,awake_fraction,loops_per_s,renders_per_s,pushes_per_s,"
+         "adv_interval_ms,adv_events_per_s\n");
+  for (const Scenario &scenario : SCENARIOS)
+  {
+    run(scenario, false, seconds);
+    run(scenario, true, seconds);
+  }
+  NativeSim::stop();
+}
+
+void loop()
+{
+}
@@ -0,0 +1,185 @@
+// PropBLEManager's write handlers: decoding of the packed control
+// characteristic, rejection of bad writes, and keeping the packed and
+// per-control characteristics in step, without rewriting them every update.
+//
+//   pio test -e native-venat -f test_ble_manager
+
+#include <unity.h>
+#include "PropBLEManager.h"
+
+PropBLEManager manager;
+
+void setUp()
+{
+  manager.led_enabled = false;
+  manager.control_mode = ControlMode::DirectRGB;
+  memset(manager.led_rgb_setting_1, 0, 3);
+  memset(manager.led_rgb_setting_2, 0, 3);
+  BLE.sim_connect_central();
+  manager.update(false);
+}
+
+void tearDown()
+{
+  BLE.sim_disconnect_central();
+  manager.update(false);
+}
+
+// A packed write, built byte by byte rather than with pack_control().
+void write_packed(uint32_t sequence, bool on, uint8_t mode, uint8_t r, uint8_t g, uint8_t b, int length = PACKED_CONTROL_SIZE)
+{
+  uint8_t packed[PACKED_CONTROL_SIZE] = {(uint8_t)sequence, (uint8_t)(sequence >> 8), (uint8_t)(sequence >> 16),
+                                         (uint8_t)(sequence >> 24), on, mode, r, g, b, 1, 2, 3};
+  manager.ble_control_characteristic.sim_central_write(packed, length);
+  manager.update(false);
+}
+
+void test_pack_unpack_round_trip()
+{
+  manager.control_sequence = 0x12345678;
+  manager.led_enabled = true;
+  manager.control_mode = ControlMode::PartyModeRolling;
+  const uint8_t rgb_1[3] = {10, 20, 30};
+  const uint8_t rgb_2[3] = {40, 50, 60};
+  memcpy(manager.led_rgb_setting_1, rgb_1, 3);
+  memcpy(manager.led_rgb_setting_2, rgb_2, 3);
+  uint8_t packed[PACKED_CONTROL_SIZE];
+  manager.pack_control(packed);
+  const uint8_t expected[PACKED_CONTROL_SIZE] = {0x78, 0x56, 0x34, 0x12, 1, 3, 10, 20, 30, 40, 50, 60};
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, packed, PACKED_CONTROL_SIZE);
+
+  // Scramble everything, then unpack under a new sequence number.
+  manager.control_sequence = 1;
+  manager.led_enabled = false;
+  manager.control_mode = ControlMode::DirectRGB;
+  memset(manager.led_rgb_setting_1, 0, 3);
+  memset(manager.led_rgb_setting_2, 0, 3);
+  TEST_ASSERT_TRUE(manager.unpack_control(packed));
+  uint8_t repacked[PACKED_CONTROL_SIZE];
+  manager.pack_control(repacked);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(packed, repacked, PACKED_CONTROL_SIZE);
+}
+
+void test_first_write_of_a_connection_is_applied()
+{
+  // Sequence 0 is where both the manager and a new client start.
+  manager.control_sequence = 0;
+  write_packed(0, true, ControlMode::PartyModeFlowing, 1, 2, 3);
+  TEST_ASSERT_TRUE(manager.led_enabled);
+  TEST_ASSERT_EQUAL(ControlMode::PartyModeFlowing, manager.control_mode);
+  TEST_ASSERT_EQUAL_UINT8(3, manager.led_rgb_setting_1[2]);
+}
+
+void test_repeated_sequence_is_dropped()
+{
+  write_packed(7, true, ControlMode::DirectRGB, 1, 2, 3);
+  write_packed(7, false, ControlMode::DirectRGBPulsing, 4, 5, 6);
+  TEST_ASSERT_TRUE(manager.led_enabled);
+  TEST_ASSERT_EQUAL(ControlMode::DirectRGB, manager.control_mode);
+  write_packed(8, false, ControlMode::DirectRGBPulsing, 4, 5, 6);
+  TEST_ASSERT_FALSE(manager.led_enabled);
+  TEST_ASSERT_EQUAL(ControlMode::DirectRGBPulsing, manager.control_mode);
+}
+
+void test_reconnect_accepts_a_restarted_sequence()
+{
+  write_packed(3, true, ControlMode::DirectRGB, 1, 2, 3);
+  BLE.sim_disconnect_central();
+  BLE.sim_connect_central();
+  manager.update(false);
+  write_packed(3, false, ControlMode::PartyModeFlowing, 4, 5, 6);
+  TEST_ASSERT_FALSE(manager.led_enabled);
+  TEST_ASSERT_EQUAL(ControlMode::PartyModeFlowing, manager.control_mode);
+}
+
+void test_short_packed_write_is_rejected()
+{
+  write_packed(11, true, ControlMode::PartyModeFlowing, 1, 2, 3, PACKED_CONTROL_SIZE - 1);
+  write_packed(12, true, ControlMode::PartyModeFlowing, 1, 2, 3, 5);
+  TEST_ASSERT_FALSE(manager.led_enabled);
+  TEST_ASSERT_EQUAL(ControlMode::DirectRGB, manager.control_mode);
+  TEST_ASSERT_EQUAL_UINT8(0, manager.led_rgb_setting_1[0]);
+}
+
+void test_unknown_mode_is_rejected()
+{
+  write_packed(21, true, 42, 1, 2, 3);
+  TEST_ASSERT_FALSE(manager.led_enabled);
+  TEST_ASSERT_EQUAL(ControlMode::DirectRGB, manager.control_mode);
+
+  manager.ble_mode_characteristic.sim_central_write(ControlMode::Keyframes + 1);
+  manager.update(false);
+  TEST_ASSERT_EQUAL(ControlMode::DirectRGB, manager.control_mode);
+  // Readers see the mode still in use, not the rejected one.
+  TEST_ASSERT_EQUAL(ControlMode::DirectRGB, manager.ble_mode_characteristic.value());
+}
+
+void test_packed_write_republishes_each_control_once()
+{
+  unsigned long switch_writes = manager.ble_switch_characteristic.sim_local_write_count();
+  unsigned long mode_writes = manager.ble_mode_characteristic.sim_local_write_count();
+  unsigned long rgb_writes = manager.ble_rgb_1_characteristic.sim_local_write_count();
+  unsigned long packed_writes = manager.ble_control_characteristic.sim_local_write_count();
+
+  write_packed(31, true, ControlMode::PartyModeRolling, 9, 8, 7);
+  manager.update(false);
+  manager.update(false);
+
+  TEST_ASSERT_EQUAL(switch_writes + 1, manager.ble_switch_characteristic.sim_local_write_count());
+  TEST_ASSERT_EQUAL(mode_writes + 1, manager.ble_mode_characteristic.sim_local_write_count());
+  TEST_ASSERT_EQUAL(rgb_writes + 1, manager.ble_rgb_1_characteristic.sim_local_write_count());
+  // The packed value came from the central; it isn't echoed back.
+  TEST_ASSERT_EQUAL(packed_writes, manager.ble_control_characteristic.sim_local_write_count());
+  TEST_ASSERT_TRUE(manager.ble_switch_characteristic.value());
+  TEST_ASSERT_EQUAL(ControlMode::PartyModeRolling, manager.ble_mode_characteristic.value());
+}
+
+void test_control_write_republishes_packed_once()
+{
+  unsigned long packed_writes = manager.ble_control_characteristic.sim_local_write_count();
+
+  const uint8_t rgb[3] = {5, 6, 7};
+  manager.ble_rgb_1_characteristic.sim_central_write(rgb, 3);
+  manager.ble_switch_characteristic.sim_central_write(true);
+  manager.update(false);
+  manager.update(false);
+
+  TEST_ASSERT_EQUAL(packed_writes + 1, manager.ble_control_characteristic.sim_local_write_count());
+  uint8_t expected[PACKED_CONTROL_SIZE];
+  manager.pack_control(expected);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, manager.ble_control_characteristic.value(), PACKED_CONTROL_SIZE);
+  TEST_ASSERT_EQUAL_UINT8(1, manager.ble_control_characteristic.value()[4]);
+  TEST_ASSERT_EQUAL_UINT8(6, manager.ble_control_characteristic.value()[7]);
+}
+
+void test_forced_update_only_writes_a_changed_switch()
+{
+  manager.update(true);
+  unsigned long switch_writes = manager.ble_switch_characteristic.sim_local_write_count();
+  manager.update(true);
+  manager.update(true);
+  TEST_ASSERT_EQUAL(switch_writes, manager.ble_switch_characteristic.sim_local_write_count());
+
+  // The prop switched itself on; readers still see it off.
+  manager.led_enabled = true;
+  manager.update(true);
+  manager.update(true);
+  TEST_ASSERT_EQUAL(switch_writes + 1, manager.ble_switch_characteristic.sim_local_write_count());
+  TEST_ASSERT_TRUE(manager.ble_switch_characteristic.value());
+}
+
+int main(int argc, char **argv)
+{
+  manager.setup("Test");
+  UNITY_BEGIN();
+  RUN_TEST(test_pack_unpack_round_trip);
+  RUN_TEST(test_first_write_of_a_connection_is_applied);
+  RUN_TEST(test_repeated_sequence_is_dropped);
+  RUN_TEST(test_reconnect_accepts_a_restarted_sequence);
+  RUN_TEST(test_short_packed_write_is_rejected);
+  RUN_TEST(test_unknown_mode_is_rejected);
+  RUN_TEST(test_packed_write_republishes_each_control_once);
+  RUN_TEST(test_control_write_republishes_packed_once);
+  RUN_TEST(test_forced_update_only_writes_a_changed_switch);
+  return UNITY_END();
+}
@@ -0,0 +1,85 @@
+// EffectProgram's arithmetic on values a program uploaded over BLE can
+// push: sums, differences, products and abs() that overflow 32 bits wrap
+// instead of being undefined.
+//
+//   pio test -e native-venat -f test_effect_program
+
+#include <unity.h>
+#include "EffectProgram.h"
+
+const uint8_t INT32_MAX_BYTES[4] = {0xFF, 0xFF, 0xFF, 0x7F};
+const uint8_t INT32_MIN_BYTES[4] = {0x00, 0x00, 0x00, 0x80};
+
+EffectProgram program;
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+// Loads code (no palette) that leaves one value, then pushes 0, 0 for G
+// and B, and returns the R channel it evaluates to.
+uint8_t red_of(const uint8_t *code, int code_length)
+{
+  uint8_t bytes[EffectProgram::MAX_SIZE] = {EffectProgram::FORMAT_VERSION, 0};
+  memcpy(bytes + 2, code, code_length);
+  const uint8_t green_blue[] = {EffectProgram::OP_PUSH16, 0, 0, EffectProgram::OP_PUSH16, 0, 0};
+  memcpy(bytes + 2 + code_length, green_blue, sizeof(green_blue));
+  TEST_ASSERT_TRUE(program.load(bytes, 2 + code_length + sizeof(green_blue)));
+  uint8_t r, g, b;
+  program.eval(EffectProgram::make_frame(0., 0, 0, 0), 0, &r, &g, &b);
+  return r;
+}
+
+void test_add_wraps()
+{
+  // INT32_MAX + INT32_MAX wraps to -2; adding 16384 (0.5) brings it back
+  // into range.
+  const uint8_t code[] = {EffectProgram::OP_PUSH32, INT32_MAX_BYTES[0], INT32_MAX_BYTES[1], INT32_MAX_BYTES[2],
+                          INT32_MAX_BYTES[3], EffectProgram::OP_DUP, EffectProgram::OP_ADD,
+                          EffectProgram::OP_PUSH16, 0x00, 0x40, EffectProgram::OP_ADD};
+  TEST_ASSERT_EQUAL_UINT8((16382 * 255 + 16384) >> 15, red_of(code, sizeof(code)));
+}
+
+void test_sub_wraps()
+{
+  // INT32_MIN - 1 wraps to INT32_MAX; less INT32_MAX - 16383 leaves 16383.
+  const uint8_t code[] = {EffectProgram::OP_PUSH32, INT32_MIN_BYTES[0], INT32_MIN_BYTES[1], INT32_MIN_BYTES[2],
+                          INT32_MIN_BYTES[3], EffectProgram::OP_PUSH16, 0x01, 0x00, EffectProgram::OP_SUB,
+                          EffectProgram::OP_PUSH32, 0x00, 0xC0, 0xFF, 0x7F, EffectProgram::OP_SUB};
+  TEST_ASSERT_EQUAL_UINT8((16383 * 255 + 16384) >> 15, red_of(code, sizeof(code)));
+}
+
+void test_abs_of_int32_min_wraps()
+{
+  // abs(INT32_MIN) stays INT32_MIN, so subtracting INT32_MIN leaves 0.
+  const uint8_t code[] = {EffectProgram::OP_PUSH32, INT32_MIN_BYTES[0], INT32_MIN_BYTES[1], INT32_MIN_BYTES[2],
+                          INT32_MIN_BYTES[3], EffectProgram::OP_ABS,
+                          EffectProgram::OP_PUSH32, INT32_MIN_BYTES[0], INT32_MIN_BYTES[1], INT32_MIN_BYTES[2],
+                          INT32_MIN_BYTES[3], EffectProgram::OP_SUB,
+                          EffectProgram::OP_PUSH16, 0x00, 0x40, EffectProgram::OP_ADD};
+  TEST_ASSERT_EQUAL_UINT8((16384 * 255 + 16384) >> 15, red_of(code, sizeof(code)));
+}
+
+void test_mul_keeps_the_low_32_bits()
+{
+  // INT32_MIN * INT32_MIN is 2^62, which >> 15 is 2^47: its low 32 bits
+  // are 0.
+  const uint8_t code[] = {EffectProgram::OP_PUSH32, INT32_MIN_BYTES[0], INT32_MIN_BYTES[1], INT32_MIN_BYTES[2],
+                          INT32_MIN_BYTES[3], EffectProgram::OP_DUP, EffectProgram::OP_MUL,
+                          EffectProgram::OP_PUSH16, 0x00, 0x40, EffectProgram::OP_ADD};
+  TEST_ASSERT_EQUAL_UINT8((16384 * 255 + 16384) >> 15, red_of(code, sizeof(code)));
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_add_wraps);
+  RUN_TEST(test_sub_wraps);
+  RUN_TEST(test_abs_of_int32_min_wraps);
+  RUN_TEST(test_mul_keeps_the_low_32_bits);
+  return UNITY_END();
+}
@@ -0,0 +1,85 @@
+// FixedTrig's table sine/cosine against std::sin / std::cos.
+//
+//   pio test -e native-venat -f test_fixed_trig
+
+#include <math.h>
+#include <stdio.h>
+#include <unity.h>
+#include "FixedTrig.h"
+
+// The table is 256 buckets with linear interpolation: the worst case is
+// ~1.6e-4 of full scale, plus rounding.
+const double MAX_ERROR = 2e-4;
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+// Every 2^12th phase: 2^20 points, 4096 per table bucket.
+template <typename Fixed, typename Reference>
+double max_error(Fixed fixed, Reference reference)
+{
+  double worst = 0;
+  for (uint64_t p = 0; p < (1ull << 32); p += 1 << 12)
+  {
+    double radians = p * (2. * M_PI / 4294967296.);
+    double error = fabs(fixed((FixedTrig::Phase)p) / (double)FixedTrig::Q15_ONE - reference(radians));
+    worst = fmax(worst, error);
+  }
+  return worst;
+}
+
+void assert_error_within_bound(double error)
+{
+  char message[64];
+  snprintf(message, sizeof(message), "max error %.3g", error);
+  TEST_ASSERT_TRUE_MESSAGE(error <= MAX_ERROR, message);
+}
+
+void test_sin_matches_std_sin()
+{
+  double error = max_error(FixedTrig::sin_q15, [](double x)
+                           { return sin(x); });
+  assert_error_within_bound(error);
+}
+
+void test_cos_matches_std_cos()
+{
+  double error = max_error(FixedTrig::cos_q15, [](double x)
+                           { return cos(x); });
+  assert_error_within_bound(error);
+}
+
+void test_quadrant_points_are_exact()
+{
+  TEST_ASSERT_EQUAL_INT16(0, FixedTrig::sin_q15(0));
+  TEST_ASSERT_EQUAL_INT16(FixedTrig::Q15_ONE, FixedTrig::sin_q15(0x40000000u));
+  TEST_ASSERT_EQUAL_INT16(0, FixedTrig::sin_q15(0x80000000u));
+  TEST_ASSERT_EQUAL_INT16(-FixedTrig::Q15_ONE, FixedTrig::sin_q15(0xC0000000u));
+  TEST_ASSERT_EQUAL_INT16(FixedTrig::Q15_ONE, FixedTrig::cos_q15(0));
+}
+
+void test_phase_from_radians_wraps()
+{
+  // Whole turns either way land back on the same phase, give or take the
+  // conversion's rounding.
+  FixedTrig::Phase base = FixedTrig::phase_from_radians(1.);
+  TEST_ASSERT_UINT_WITHIN(16, base, FixedTrig::phase_from_radians(1. + 2. * M_PI));
+  TEST_ASSERT_UINT_WITHIN(16, base, FixedTrig::phase_from_radians(1. - 4. * M_PI));
+  TEST_ASSERT_FLOAT_WITHIN(MAX_ERROR, sin(-2.5),
+                           FixedTrig::sin_q15(FixedTrig::phase_from_radians(-2.5)) / (double)FixedTrig::Q15_ONE);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_sin_matches_std_sin);
+  RUN_TEST(test_cos_matches_std_cos);
+  RUN_TEST(test_quadrant_points_are_exact);
+  RUN_TEST(test_phase_from_radians_wraps);
+  return UNITY_END();
+}
@@ -0,0 +1,85 @@
+// Every prop in every mode but Keyframes against its golden frames in
+// test/golden. After a change that's meant to change the output, regenerate
+// them with render-frames --update-golden and check them in with it.
+//
+//   pio test -e native-venat -f test_golden_frames
+
+#include <stdio.h>
+#include <unity.h>
+#include "PropLayouts.h"
+#include "GoldenFrames.h"
+
+// Rounding and dithering changes may move a level by one.
+const int TOLERANCE = 1;
+
+uint8_t program[EffectProgram::MAX_SIZE];
+int program_length = -1;
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+template <typename Layout>
+void check_golden(const char *prop)
+{
+  TEST_ASSERT_TRUE_MESSAGE(program_length > 0, GoldenFrames::GOLDEN_PROGRAM_PATH);
+  for (int mode = 0; mode < GoldenFrames::NUM_GOLDEN_MODES; mode++)
+  {
+    char path[64];
+    GoldenFrames::golden_path(path, prop, mode);
+    GoldenFrames::Renderer<Layout> renderer(GoldenFrames::golden_settings(mode, program, program_length));
+    TEST_ASSERT_TRUE(renderer.program_ok());
+
+    GoldenFrames::Comparison result;
+    char message[128];
+    snprintf(message, sizeof(message), "can't read %s, or its strips differ", path);
+    TEST_ASSERT_TRUE_MESSAGE(GoldenFrames::compare_render(renderer, path, TOLERANCE, &result), message);
+    snprintf(message, sizeof(message), "%s: %u frames rendered, %u golden", path, (unsigned)result.frames,
+             (unsigned)result.golden_frames);
+    TEST_ASSERT_TRUE_MESSAGE(result.frames == result.golden_frames, message);
+    snprintf(message, sizeof(message), "%s: %u frames over tolerance, first %ld, max difference %d", path,
+             (unsigned)result.frames_over, result.first_over, result.max_diff);
+    TEST_ASSERT_TRUE_MESSAGE(result.ok(), message);
+  }
+}
+
+void test_venat_matches_golden()
+{
+  check_golden<VenatLayout>("venat");
+}
+
+void test_hermes_matches_golden()
+{
+  check_golden<HermesLayout>("hermes");
+}
+
+void test_hyth_matches_golden()
+{
+  check_golden<HythLayout>("hyth");
+}
+
+void test_hyth_arrow_matches_golden()
+{
+  check_golden<HythArrowLayout>("hyth-arrow");
+}
+
+void test_emet_matches_golden()
+{
+  check_golden<EmetLayout>("emet");
+}
+
+int main(int argc, char **argv)
+{
+  program_length = GoldenFrames::read_program_hex(GoldenFrames::GOLDEN_PROGRAM_PATH, program);
+  UNITY_BEGIN();
+  RUN_TEST(test_venat_matches_golden);
+  RUN_TEST(test_hermes_matches_golden);
+  RUN_TEST(test_hyth_matches_golden);
+  RUN_TEST(test_hyth_arrow_matches_golden);
+  RUN_TEST(test_emet_matches_golden);
+  return UNITY_END();
+}
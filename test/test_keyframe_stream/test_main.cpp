@@ -0,0 +1,200 @@
+// KeyframeStream's ring buffer: decoding, the received/overrun/underrun
+// counters, and what sample() plays back at given times, including once the
+// indices have wrapped round the buffer several times.
+//
+//   pio test -e native-venat -f test_keyframe_stream
+
+#include <unity.h>
+#include "PropBLEManager.h"
+
+const int CAPACITY = KeyframeStream::CAPACITY;
+const unsigned long START_MS = 1000;
+
+KeyframeStream stream;
+
+void setUp()
+{
+  NativeSim::set_time_us(START_MS * 1000);
+  stream = KeyframeStream();
+}
+
+void tearDown()
+{
+}
+
+// Keyframes in these tests carry their own number in the color, so what
+// plays back shows which keyframe it came from.
+uint8_t red_of(int i)
+{
+  return (i * 37) & 0xFF;
+}
+
+Keyframe numbered(int i, uint32_t time_ms, uint8_t flags = KEYFRAME_ON)
+{
+  return {time_ms, flags, ControlMode::DirectRGB, red_of(i), (uint8_t)i, (uint8_t)(255 - i)};
+}
+
+// Samples at timeline_ms on a stream whose first keyframe was at 0 and was
+// pushed at START_MS.
+Keyframe sample_at(long timeline_ms)
+{
+  Keyframe out;
+  TEST_ASSERT_TRUE(stream.sample(START_MS + stream.lead_ms + timeline_ms, &out));
+  return out;
+}
+
+void test_push_packed_decodes_whole_keyframes()
+{
+  const uint8_t packed[2 * KEYFRAME_SIZE + 4] = {
+      0, 0, 0, 0, KEYFRAME_ON, ControlMode::DirectRGB, 10, 20, 30,
+      0x10, 0x27, 0, 0, KEYFRAME_ON | KEYFRAME_END, ControlMode::PartyModeFlowing, 40, 50, 60,
+      // A trailing partial keyframe.
+      0x20, 0x4E, 0, 0};
+  stream.push_packed(packed, sizeof(packed));
+  TEST_ASSERT_EQUAL(2, stream.received);
+  TEST_ASSERT_EQUAL(2, stream.size());
+
+  Keyframe first = sample_at(0);
+  TEST_ASSERT_EQUAL_UINT32(0, first.time_ms);
+  TEST_ASSERT_EQUAL_UINT8(KEYFRAME_ON, first.flags);
+  TEST_ASSERT_EQUAL_UINT8(ControlMode::DirectRGB, first.mode);
+  TEST_ASSERT_EQUAL_UINT8(10, first.r);
+  TEST_ASSERT_EQUAL_UINT8(20, first.g);
+  TEST_ASSERT_EQUAL_UINT8(30, first.b);
+
+  Keyframe last = sample_at(10000);
+  TEST_ASSERT_EQUAL_UINT32(10000, last.time_ms);
+  TEST_ASSERT_EQUAL_UINT8(KEYFRAME_ON | KEYFRAME_END, last.flags);
+  TEST_ASSERT_EQUAL_UINT8(ControlMode::PartyModeFlowing, last.mode);
+  TEST_ASSERT_EQUAL_UINT8(60, last.b);
+}
+
+void test_nothing_streamed_samples_nothing()
+{
+  Keyframe out;
+  TEST_ASSERT_FALSE(stream.sample(START_MS, &out));
+}
+
+void test_sample_blends_between_keyframes()
+{
+  stream.push({0, KEYFRAME_ON, ControlMode::DirectRGB, 0, 200, 100});
+  stream.push({1000, KEYFRAME_ON | KEYFRAME_END, ControlMode::DirectRGB, 200, 0, 100});
+
+  // Before playback starts the first keyframe holds.
+  TEST_ASSERT_EQUAL_UINT8(0, sample_at(-100).r);
+  TEST_ASSERT_EQUAL_UINT8(0, sample_at(0).r);
+  Keyframe quarter = sample_at(250);
+  TEST_ASSERT_EQUAL_UINT8(50, quarter.r);
+  TEST_ASSERT_EQUAL_UINT8(150, quarter.g);
+  TEST_ASSERT_EQUAL_UINT8(100, quarter.b);
+  TEST_ASSERT_EQUAL_UINT8(100, sample_at(500).r);
+  TEST_ASSERT_EQUAL_UINT8(200, sample_at(1000).r);
+  // The first keyframe has been played past.
+  TEST_ASSERT_EQUAL(1, stream.size());
+}
+
+void test_full_buffer_counts_overruns()
+{
+  for (int i = 0; i < CAPACITY; i++)
+  {
+    TEST_ASSERT_TRUE(stream.push(numbered(i, i * 10)));
+  }
+  for (int i = CAPACITY; i < CAPACITY + 3; i++)
+  {
+    TEST_ASSERT_FALSE(stream.push(numbered(i, i * 10)));
+  }
+  TEST_ASSERT_EQUAL(CAPACITY + 3, stream.received);
+  TEST_ASSERT_EQUAL(3, stream.overruns);
+  TEST_ASSERT_EQUAL(CAPACITY, stream.size());
+  // The dropped ones are the newest.
+  TEST_ASSERT_EQUAL_UINT8(red_of(CAPACITY - 1), sample_at(100000).r);
+}
+
+void test_underrun_counted_once_per_gap()
+{
+  stream.push(numbered(0, 0));
+  stream.push(numbered(1, 100));
+  sample_at(150);
+  Keyframe held = sample_at(200);
+  TEST_ASSERT_EQUAL(1, stream.underruns);
+  TEST_ASSERT_EQUAL_UINT8(red_of(1), held.r);
+
+  // The link catches up: playback blends again, and running dry a second
+  // time is a second underrun.
+  stream.push(numbered(2, 300));
+  Keyframe blended = sample_at(250);
+  TEST_ASSERT_EQUAL_UINT8((red_of(1) * 64 + red_of(2) * 192) >> 8, blended.r);
+  TEST_ASSERT_EQUAL(1, stream.underruns);
+  sample_at(400);
+  TEST_ASSERT_EQUAL(2, stream.underruns);
+}
+
+void test_end_keyframe_holds_without_underrun()
+{
+  stream.push(numbered(0, 0));
+  stream.push(numbered(1, 100, KEYFRAME_ON | KEYFRAME_END));
+  Keyframe held = sample_at(5000);
+  TEST_ASSERT_EQUAL_UINT8(red_of(1), held.r);
+  TEST_ASSERT_EQUAL_UINT8(KEYFRAME_ON | KEYFRAME_END, held.flags);
+  TEST_ASSERT_EQUAL(0, stream.underruns);
+}
+
+void test_playback_across_wraparound()
+{
+  // Several times round the buffer, staying half a buffer ahead of
+  // playback the way the app does.
+  const int n = 3 * CAPACITY + 5;
+  int pushed = 0;
+  for (int i = 0; i < n; i++)
+  {
+    while (pushed < n && pushed < i + CAPACITY / 2)
+    {
+      uint8_t flags = pushed == n - 1 ? KEYFRAME_ON | KEYFRAME_END : KEYFRAME_ON;
+      TEST_ASSERT_TRUE(stream.push(numbered(pushed, pushed * 10, flags)));
+      pushed++;
+    }
+    TEST_ASSERT_LESS_OR_EQUAL(CAPACITY, stream.size());
+    Keyframe on_time = sample_at(i * 10);
+    TEST_ASSERT_EQUAL_UINT32(i * 10, on_time.time_ms);
+    TEST_ASSERT_EQUAL_UINT8(red_of(i), on_time.r);
+    if (i + 1 < n)
+    {
+      TEST_ASSERT_EQUAL_UINT8((red_of(i) + red_of(i + 1)) / 2, sample_at(i * 10 + 5).r);
+    }
+  }
+  TEST_ASSERT_EQUAL_UINT8(red_of(n - 1), sample_at(n * 10 + 1000).r);
+  TEST_ASSERT_EQUAL(n, stream.received);
+  TEST_ASSERT_EQUAL(0, stream.overruns);
+  TEST_ASSERT_EQUAL(0, stream.underruns);
+}
+
+void test_earlier_time_starts_new_stream()
+{
+  stream.push(numbered(0, 0));
+  stream.push(numbered(1, 100));
+  stream.push(numbered(2, 200));
+  sample_at(150);
+
+  // The new stream's timeline starts from when its first keyframe arrives.
+  NativeSim::advance_us(2000000);
+  stream.push(numbered(3, 50));
+  TEST_ASSERT_EQUAL(1, stream.size());
+  TEST_ASSERT_EQUAL(4, stream.received);
+  Keyframe out;
+  TEST_ASSERT_TRUE(stream.sample(START_MS + 2000 + stream.lead_ms, &out));
+  TEST_ASSERT_EQUAL_UINT8(red_of(3), out.r);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_push_packed_decodes_whole_keyframes);
+  RUN_TEST(test_nothing_streamed_samples_nothing);
+  RUN_TEST(test_sample_blends_between_keyframes);
+  RUN_TEST(test_full_buffer_counts_overruns);
+  RUN_TEST(test_underrun_counted_once_per_gap);
+  RUN_TEST(test_end_keyframe_holds_without_underrun);
+  RUN_TEST(test_playback_across_wraparound);
+  RUN_TEST(test_earlier_time_starts_new_stream);
+  return UNITY_END();
+}
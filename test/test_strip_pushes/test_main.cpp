@@ -0,0 +1,88 @@
+// Which frames PropLEDDriver pushes to the strips: a still frame stops
+// being pushed once it has gone out, whichever path rendered it, and an
+// animated one is pushed every frame.
+//
+//   pio test -e native-venat -f test_strip_pushes
+
+#include <unity.h>
+#include <Adafruit_NeoPixel.h>
+#include "EffectAssembler.h"
+#include "PropLayouts.h"
+
+const uint64_t FRAME_US = 16667;
+// Long enough for the switch-on transition to finish.
+const int SETTLE_FRAMES = 120;
+const int COUNTED_FRAMES = 60;
+
+PropLEDDriver<VenatLayout> *driver;
+Adafruit_NeoPixel pixels_sword(VENAT_TIP_LED_END, 10, NEO_GRB);
+Adafruit_NeoPixel pixels_gems(VENAT_NUM_PIXELS_GEMS, 8, NEO_GRB);
+
+void setUp()
+{
+  driver = new PropLEDDriver<VenatLayout>();
+  driver->register_strips(&pixels_sword, &pixels_gems);
+}
+
+void tearDown()
+{
+  delete driver;
+}
+
+// Runs SETTLE_FRAMES frames of mode, then returns the pushes over the next
+// COUNTED_FRAMES, summed over the strips.
+unsigned long pushes_after_settling(ControlMode mode)
+{
+  PropLEDDriverBase::ControlInput input = {0., true, {40, 60, 90}, mode};
+  for (int f = 0; f < SETTLE_FRAMES; f++)
+  {
+    NativeSim::advance_us(FRAME_US);
+    input.t = NativeSim::time_us() / 1e6;
+    driver->update(input);
+  }
+  unsigned long pushed = driver->m_frame_stats.frames_pushed;
+  for (int f = 0; f < COUNTED_FRAMES; f++)
+  {
+    NativeSim::advance_us(FRAME_US);
+    input.t = NativeSim::time_us() / 1e6;
+    driver->update(input);
+  }
+  return driver->m_frame_stats.frames_pushed - pushed;
+}
+
+void test_still_solid_frame_stops_pushing()
+{
+  TEST_ASSERT_EQUAL(0, pushes_after_settling(ControlMode::DirectRGB));
+}
+
+void test_still_per_pixel_frame_stops_pushing()
+{
+  driver->m_solid_fill = false;
+  TEST_ASSERT_EQUAL(0, pushes_after_settling(ControlMode::DirectRGB));
+}
+
+void test_still_program_stops_pushing()
+{
+  // A gradient along the blade that doesn't move.
+  uint8_t program[EffectProgram::MAX_SIZE];
+  char error[128];
+  int length = EffectAssembler::assemble("#ff0000 #0000ff i 0.01 mul palette", program, error, sizeof(error));
+  TEST_ASSERT_TRUE_MESSAGE(length > 0, error);
+  TEST_ASSERT_TRUE(driver->load_program(program, length));
+  TEST_ASSERT_EQUAL(0, pushes_after_settling(ControlMode::Program));
+}
+
+void test_animated_frame_keeps_pushing()
+{
+  TEST_ASSERT_EQUAL(COUNTED_FRAMES * VenatLayout::NUM_STRIPS, pushes_after_settling(ControlMode::PartyModeFlowing));
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_still_solid_frame_stops_pushing);
+  RUN_TEST(test_still_per_pixel_frame_stops_pushing);
+  RUN_TEST(test_still_program_stops_pushing);
+  RUN_TEST(test_animated_frame_keeps_pushing);
+  return UNITY_END();
+}